@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "event.h"
+
+#define REPEAT 200
+
+static struct event unpacked_log[MAX_POS];
+static struct event packed_log[MAX_ENTRY];
+
+typedef struct event *(*find_func)(struct event *, int *, unsigned char, unsigned char);
+
+/* walk all OUT_BIT edges like parse_event() does */
+static int walk_edges(find_func find, long *sum)
+{
+	struct event *ev;
+	int i, n;
+
+	ev = unpacked_log;
+	n = MAX_POS;
+	for (i = 0; ; i++) {
+		if ((ev = find(ev, &n, OUT_BIT, (i & 1) ? 0 : OUT_BIT)) == NULL)
+			break;
+		*sum += ev->pos;
+		ev++;
+		n--;
+	}
+
+	return i;
+}
+
+static double run(char *name, find_func find, long *sum)
+{
+	struct timespec t0, t1;
+	double ns;
+	int i, edges = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < REPEAT; i++)
+		edges = walk_edges(find, sum);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+		REPEAT;
+	printf("%-8s %3d edges, %8.1f us/scan, %5.2f ns/entry\n",
+	       name, edges, ns / 1e3, ns / MAX_POS);
+
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	struct event *ev;
+	long sum0 = 0, sum1 = 0;
+	double t0, t1;
+	int i, pos;
+
+	/* dit-like output, 16 edges spread over the window */
+	ev = packed_log;
+	for (i = 0, pos = 0x2000; i < 16; i++, pos += 0x0c00)
+		ev = add_event_entry(ev, pos, (i & 1) ? 0 : OUT_BIT, 0);
+	unpack_events(unpacked_log, MAX_POS, packed_log, ev - packed_log);
+
+	t0 = run("scalar", find_event_entry_scalar, &sum0);
+	t1 = run("dispatch", find_event_entry, &sum1);
+
+	if (sum0 != sum1) {
+		printf("result mismatch\n");
+		return 1;
+	}
+
+	printf("speedup %.2fx\n", t0 / t1);
+
+	return 0;
+}
@@ -32,18 +32,101 @@ void unpack_events(struct event *out, int entry_out, struct event *in, int entry
 	}
 }
 
+static int scan_event_scalar(struct event *ev, int n, unsigned char mask, unsigned char val)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if ((ev[i].val & mask) == val)
+			break;
+	}
+
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * struct event is 4 bytes, so one 32-bit lane holds one entry and
+ * val is in bits 16-23 of the lane.
+ */
+
+__attribute__((target("sse2")))
+static int scan_event_sse2(struct event *ev, int n, unsigned char mask, unsigned char val)
+{
+	__m128i m, v, x;
+	int i, hit;
+
+	m = _mm_set1_epi32(mask << 16);
+	v = _mm_set1_epi32(val << 16);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = _mm_loadu_si128((__m128i *)&ev[i]);
+		x = _mm_cmpeq_epi32(_mm_and_si128(x, m), v);
+		if ((hit = _mm_movemask_ps(_mm_castsi128_ps(x))) != 0)
+			return i + __builtin_ctz(hit);
+	}
+
+	return i + scan_event_scalar(&ev[i], n - i, mask, val);
+}
+
+__attribute__((target("avx2")))
+static int scan_event_avx2(struct event *ev, int n, unsigned char mask, unsigned char val)
+{
+	__m256i m, v, x;
+	int i, hit;
+
+	m = _mm256_set1_epi32(mask << 16);
+	v = _mm256_set1_epi32(val << 16);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm256_loadu_si256((__m256i *)&ev[i]);
+		x = _mm256_cmpeq_epi32(_mm256_and_si256(x, m), v);
+		if ((hit = _mm256_movemask_ps(_mm256_castsi256_ps(x))) != 0)
+			return i + __builtin_ctz(hit);
+	}
+
+	return i + scan_event_sse2(&ev[i], n - i, mask, val);
+}
+
+/* resolved once before main(), so callers never race on the pointer */
+static int (*scan_event)(struct event *, int, unsigned char, unsigned char) = scan_event_scalar;
+
+__attribute__((constructor))
+static void scan_event_init(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		scan_event = scan_event_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan_event = scan_event_sse2;
+}
+#else
+#define scan_event scan_event_scalar
+#endif
+
 struct event *find_event_entry(struct event *ev, int *entry, unsigned char mask, unsigned char val)
 {
 	int i, n;
 
-	for (i = 0, n = *entry; i < n; i++) {
-		if ((ev->val & mask) == val)
-			return ev;
-		ev++;
-		(*entry)--;
-	}
+	n = *entry;
+	i = scan_event(ev, n, mask, val);
+	*entry -= i;
+
+	return (i < n) ? ev + i : NULL;
+}
+
+struct event *find_event_entry_scalar(struct event *ev, int *entry, unsigned char mask, unsigned char val)
+{
+	int i, n;
+
+	n = *entry;
+	i = scan_event_scalar(ev, n, mask, val);
+	*entry -= i;
 
-	return NULL;
+	return (i < n) ? ev + i : NULL;
 }
 
 struct event *add_event_entry(struct event *ev, int pos, int val, int evt)
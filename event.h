@@ -6,8 +6,13 @@
 
 #include "keyer-test-arduino.h"
 
+#define DIT_BIT 0x01
+#define DAH_BIT 0x02
+#define OUT_BIT 0x01
+
 void unpack_events(struct event *, int, struct event *, int);
 struct event *find_event_entry(struct event *, int *, unsigned char, unsigned char);
+struct event *find_event_entry_scalar(struct event *, int *, unsigned char, unsigned char);
 struct event *add_event_entry(struct event *, int, int, int);
 
 #endif
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "iambic.h"
+#include "event.h"
+
+static unsigned char level_at(struct paddle_edge *e, int entry, unsigned char val, int t)
+{
+	for (; entry > 0 && e->pos <= t; entry--, e++)
+		val = e->val;
+
+	return val;
+}
+
+static int near_edge(struct paddle_edge *e, int entry, int t, int guard)
+{
+	int i;
+
+	for (i = 0; i < entry; i++) {
+		if (abs(e[i].pos - t) < guard)
+			return i;
+	}
+
+	return -1;
+}
+
+static bool pressed_within(struct paddle_edge *e, int entry, unsigned char val, int t0, int t1, unsigned char mask)
+{
+	if (level_at(e, entry, val, t0) & mask)
+		return true;
+
+	for (; entry > 0; entry--, e++) {
+		if (e->pos > t0 && e->pos < t1 && (e->val & mask))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * reference iambic keyer with dit/dah memory
+ *
+ * t=0 is the start of the first element (OUT goes on), paddle state at t=0
+ * is given by initial, e[] holds the paddle state after each change.
+ * an opposite paddle pressed at any time during an element (mark + space)
+ * is memorized and sent next, otherwise the element repeats while its own
+ * paddle is held at the end of the space.
+ *
+ * returns the number of elements written to out[] (null-terminated) and
+ * the end of the last space in *end.  returns -1 when a paddle edge is
+ * within guard of an element boundary (*edge = its index), or when more
+ * than size elements would be sent (*edge = -1).
+ */
+int iambic_model(struct iambic_timing *tm, unsigned char initial, struct paddle_edge *e, int entry, char *out, int size, int *end, int *edge)
+{
+	unsigned char cur, opp;
+	int n, t, len, i;
+	bool mem;
+
+	cur = (initial & DIT_BIT) ? DIT_BIT : DAH_BIT;
+
+	for (n = t = 0; ; ) {
+		if (n >= size) {
+			*edge = -1;
+			return -1;
+		}
+
+		len = (cur == DIT_BIT) ?
+			tm->dit_on + tm->dit_off : tm->dah_on + tm->dah_off;
+
+		if ((n && (i = near_edge(e, entry, t, tm->guard)) >= 0) ||
+		    (i = near_edge(e, entry, t + len, tm->guard)) >= 0) {
+			*edge = i;
+			return -1;
+		}
+
+		out[n++] = (cur == DIT_BIT) ? '.' : '-';
+
+		opp = cur ^ (DIT_BIT | DAH_BIT);
+		mem = pressed_within(e, entry, initial, t, t + len, opp);
+		t += len;
+
+		if (mem)
+			cur = opp;
+		else if (!(level_at(e, entry, initial, t) & cur))
+			break;
+	}
+
+	out[n] = '\0';
+	*end = t;
+
+	return n;
+}
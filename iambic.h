@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#ifndef IAMBIC_H
+#define IAMBIC_H
+
+struct iambic_timing {
+	int dit_on, dit_off;
+	int dah_on, dah_off;
+	int guard;
+};
+
+struct paddle_edge {
+	int pos;
+	unsigned char val;
+};
+
+int iambic_model(struct iambic_timing *, unsigned char, struct paddle_edge *, int, char *, int, int *, int *);
+
+#endif
@@ -11,6 +11,7 @@ struct event {
 } __attribute__((packed));
 
 #define MAX_POS 0xf000U
+#define TICK_NS 64000U	/* log tick, 16MHz / 1024 */
 #define MAX_ENTRY 128
 
 #define CMD_READY 0x00
@@ -19,11 +20,80 @@ struct event {
 #define CMD_LOG 0x03
 #define CMD_RESULT 0x04
 #define CMD_MAXPOS 0x05
+#define CMD_CAPS 0x06
+#define CMD_FRAMED 0x07
+#define CMD_RESEND 0x08
+#define CMD_PATCH 0x09
+#define CMD_SWEEP 0x0a
+#define CMD_MONITOR 0x0b
+
+#define CAP_FRAMED 0x01
+#define CAP_PATCH 0x02
+#define CAP_SWEEP 0x04
+#define CAP_MONITOR 0x08
 
 #define EVT_SET 0x00
 #define EVT_CHGSTS 0x01
+#define EVT_MON 0x02
+#define EVT_MONEND 0x03
+
+#define MON_OUT 0x01
+#define MON_DIT 0x02
+#define MON_DAH 0x04
 
 #define RESP_NAK 0x55
 #define RESP_ACK 0xaa
 
+/*
+ * CMD_CAPS is answered with RESP_ACK and then the CAP_* bits, so the
+ * caps byte is never taken for RESP_ACK/RESP_NAK.  firmware without it
+ * answers RESP_NAK.
+ *
+ * CMD_PATCH first (count - 1) (entries - 1) event[count]
+ * replaces event[first..first+count-1] of the program stored by the
+ * last CMD_EVENT/CMD_PATCH, and sets the program length to entries.
+ * CAP_PATCH also means that the program and CMD_MAXPOS are kept across
+ * captures, so the host does not re-send them when they are unchanged.
+ *
+ * CMD_SWEEP first step_lo step_hi (count - 1) results
+ * runs the stored program count times, adding k * step to the pos of
+ * event[first..] in run k, and returns for each run the first results
+ * OUT_BIT intervals from the first OUT_BIT rise (as 16-bit values, lo
+ * first), preceded by how many were found.  RESP_ACK follows the last
+ * run.  the stored program itself is left unchanged.
+ *
+ * CMD_MONITOR streams EVT_MON events until the next command byte: pos
+ * is a free-running 16-bit tick count, val the MON_* levels.  one event
+ * is sent per change and at least one every 0x4000 ticks.  the command
+ * byte that stops it is not executed; the device sends an EVT_MONEND
+ * event and RESP_ACK instead.
+ */
+
+/*
+ * framed mode (after CMD_FRAMED is ACKed)
+ *
+ * FRAME_FLAG seq payload... crc_lo crc_hi FRAME_FLAG
+ * FRAME_FLAG and FRAME_ESC in between are sent as FRAME_ESC (c ^ 0x20).
+ * crc is CRC-16/CCITT (0x1021, init 0xffff) over seq and payload.
+ *
+ * a request carries the command and its arguments as payload, the
+ * response uses the same seq.  a request with the seq of the previous
+ * one is a retransmit: the device re-sends the previous response
+ * without executing the command again.  the host retransmits CMD_LOG
+ * and CMD_SWEEP when nothing arrived one capture after the request, so
+ * such a retransmit may also arrive while the capture is still running.
+ *
+ * CMD_RESULT is answered with one frame per FRAME_LOG_ENTRY entries,
+ * payload is (entries - 1), chunk number, entries of that chunk.
+ * CMD_SWEEP is answered with one frame per run, payload is run number,
+ * number of intervals, intervals.  CMD_RESEND n re-sends frame n of
+ * the last CMD_RESULT/CMD_SWEEP response.  CMD_MONITOR events come in
+ * frames with its seq, any number of events per frame; the request that
+ * stops it is answered with an EVT_MONEND frame and RESP_ACK.  other
+ * commands are answered with RESP_ACK.
+ */
+#define FRAME_FLAG 0x7e
+#define FRAME_ESC 0x7d
+#define FRAME_LOG_ENTRY 32
+
 #endif
@@ -0,0 +1,1221 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "serial.h"
+#include "event.h"
+#include "vcd.h"
+#include "iambic.h"
+#include "keyertest.h"
+#include "keyer-test-arduino.h"
+
+#define MON_RING 256		/* power of 2 */
+#define MON_POLL 20		/* ms */
+#define MON_ELEMENTS 64		/* per character line */
+
+struct kt_session {
+	struct link link;
+	struct kt_callbacks cb;
+	struct event unpacked_log[MAX_POS];
+	struct event packed_log[MAX_ENTRY];
+	int packed_log_entry;
+	struct event eventbuf[MAX_ENTRY];
+	int calib_on_1, calib_off_1, calib_on_2, calib_off_2;
+	int dit_on, dit_off, dah_on, dah_off;
+	int dit_total, dah_total;
+	bool verbose;
+	int log_len;
+	struct vcd vcd;
+	struct event mon_ring[MON_RING];
+	unsigned int mon_head, mon_tail;
+};
+
+#define DITDAH_LEN 0x8000
+#define DITDAH_POS 0x2000
+
+#define CALIB_LEN 0x2000
+#define CALIB_POS 0x0800
+
+#define STEP 4
+#define RESULTS 8
+#define SQ_RESULTS 10
+#define MAX_RESULTS SQ_RESULTS
+
+#define SWEEP_FIRST 4	/* first offset-dependent entry of build_*() */
+
+#define BENCH_COUNT 100
+
+#define STRESS_ELEMENTS 60		/* two log entries per element */
+#define STRESS_EDGES (MAX_ENTRY - 3)	/* after the OUT_BIT trigger */
+
+//#define DEBUG
+#ifdef DEBUG
+#define DEBUG_PRINT(x) printf x
+#else
+#define DEBUG_PRINT(x) /* */
+#endif
+
+static void kt_printf(struct kt_session *s, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void kt_printf(struct kt_session *s, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	if (s->cb.message == NULL)
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	s->cb.message(s->cb.arg, buf);
+}
+
+static void kt_report(struct kt_session *s, const char *test, const char *label, int step, int steps, const char *elements)
+{
+	struct kt_result r;
+
+	if (s->cb.result == NULL)
+		return;
+
+	r.test = test;
+	r.label = label;
+	r.step = step;
+	r.steps = steps;
+	r.elements = elements;
+
+	s->cb.result(s->cb.arg, &r);
+}
+
+static int set_log_window(struct kt_session *s, int len)
+{
+	s->log_len = len;
+
+	if (set_maxpos(&s->link, len) < 0) {
+		kt_printf(s, "device not responding\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int send_event_and_get_log(struct kt_session *s, int event_entry)
+{
+	if (write_event(&s->link, s->eventbuf, event_entry) < 0 ||
+	    start_log(&s->link) < 0 ||
+	    (s->packed_log_entry = read_log(&s->link, s->packed_log,
+					    MAX_ENTRY)) < 0) {
+		kt_printf(s, "device not responding\n");
+		invalidate_link(&s->link);
+		s->packed_log_entry = 0;
+		return -1;
+	}
+
+	unpack_events(s->unpacked_log, MAX_POS,
+		      s->packed_log, s->packed_log_entry);
+
+	vcd_add_probe(&s->vcd, s->eventbuf, event_entry,
+		      s->packed_log, s->packed_log_entry, s->log_len);
+
+	return 0;
+}
+
+static int parse_event(struct event *ev, int entry, int *out, int size)
+{
+	int i, j, n, t0, t1;
+
+	/*
+	 *    t[0]     t[1]     t[2]     t[3]     t[4]     t[5]     t[6]
+	 *     :        :        :        :        :        :        :
+	 *     +--------+        +--------+        +--------+        +---- 
+	 *     |        |        |        |        |        |        |
+	 * ----+        +--------+        +--------+        +--------+
+	 *     :        :        :        :        :        :        :
+	 *     |<-u[0]->|<-u[1]->|<-u[2]->|<-u[3]->|<-u[4]->|<-u[5]->|
+	 */
+
+	n = entry;
+	for (i = j = 0; i < size + 1; i++) {
+		if ((ev = find_event_entry(ev, &n, OUT_BIT,
+					   (i & 1) ? 0 : OUT_BIT)) == NULL)
+			break;
+
+		t1 = ev->pos;
+		if (i) out[j++] = t1 - t0;
+		t0 = t1;
+
+		ev++;
+		n--;
+	}
+	for (i = j; i < size; i++) out[i] = -1;
+
+	DEBUG_PRINT(("#"));
+	for (i = 0; i < size; i++) DEBUG_PRINT((" %d", out[i]));
+	DEBUG_PRINT(("\n"));
+
+	return j;
+}
+
+static char detect_element(struct kt_session *s, int v)
+{
+#define RANGE 10
+#define DIFF(x, t) ((((x) - t) * 100) / (t))
+	
+	if (v < 0) return ' ';
+	else if (DIFF(v, s->dit_total / 2) >= -10 &&
+		 DIFF(v, s->dit_total / 2) <= 10) return '.';
+	else return '-';
+}
+
+static int build_squeeze(struct kt_session *s, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width)
+{
+	int n, t0, t1, m;
+	struct event *ev, *ev0;
+
+	ev = add_event_entry(ev0 = s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
+	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+	ev = add_event_entry(ev, 1, sig0 | sig1, EVT_SET);
+
+	t0 = offset + width - sig0_off_delay;
+	t1 = offset + width - sig1_off_delay;
+	if (!sig1 || t0 == t1) {
+		// no sig1, or sig0 and sig1 same timing
+		m = 0;
+	} else if (t0 < t1) {
+		// sig0 first
+		m = sig1;
+	} else {
+		// sig1 first
+		m = sig0;
+		n = t1;
+		t1 = t0;
+		t0 = n;
+	}
+	ev = add_event_entry(ev, t0, m, EVT_SET);
+	if (m)
+		ev = add_event_entry(ev, t1, 0, EVT_SET);
+
+	return ev - ev0;
+}
+
+static int build_ditdah_memory(struct kt_session *s, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width)
+{
+	int n, t0, t1, m;
+	struct event *ev, *ev0;
+
+	ev = add_event_entry(ev0 = s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
+	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+	ev = add_event_entry(ev, 1, sig0, EVT_SET);
+	if (sig1) {
+		ev = add_event_entry(ev, offset - sig1_on_delay,
+				     sig0 | sig1, EVT_SET);
+	}
+
+	t0 = offset + width - sig0_off_delay;
+	t1 = offset + width - sig1_off_delay;
+	if (!sig1 || t0 == t1) {
+		// no sig1, or sig0 and sig1 same timing
+		m = 0;
+	} else if (t0 < t1) {
+		// sig0 first
+		m = sig1;
+	} else {
+		// sig1 first
+		m = sig0;
+		n = t1;
+		t1 = t0;
+		t0 = n;
+	}
+	ev = add_event_entry(ev, t0, m, EVT_SET);
+	if (m)
+		ev = add_event_entry(ev, t1, 0, EVT_SET);
+
+	return ev - ev0;
+}
+
+static int build_ditdah_memory2(struct kt_session *s, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width)
+{
+	struct event *ev, *ev0;
+
+	ev = add_event_entry(ev0 = s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
+	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+
+	// different from build_ditdah_memory(), non-squeeze
+	ev = add_event_entry(ev, 1, 0, EVT_SET);
+	ev = add_event_entry(ev, offset - sig1_on_delay, sig1, EVT_SET);
+	ev = add_event_entry(ev, offset + width - sig1_off_delay, 0, EVT_SET);
+
+	return ev - ev0;
+}
+
+typedef int (*build_func)(struct kt_session *, unsigned char, int, int, unsigned char, int, int, int, int);
+
+static char *decode_elements(struct kt_session *s, int *u, char *result_str, int results)
+{
+	int n;
+
+	for (n = 0; n < results / 2; n++)
+		result_str[n] = detect_element(s, u[n * 2]);
+	result_str[n] = '\0';
+
+	return result_str;
+}
+
+static int sweep(struct kt_session *s, const char *test, const char *label, build_func build, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, double offset, double width, double step, double limit, int steps, int results)
+{
+	int n, count, entry, *u;
+	double i;
+	char result_str1[MAX_RESULTS / 2 + 1], result_str2[MAX_RESULTS / 2 + 1];
+
+	if (set_log_window(s, DITDAH_LEN) < 0)
+		return -1;
+	memset(result_str1, 0, sizeof(result_str1));
+
+	for (count = 0, i = offset; i < limit; i += step)
+		count++;
+
+	/*
+	 * whole sweep on the device: upload the first probe as template,
+	 * every later probe only shifts the offset-dependent entries.
+	 * not while exporting waveforms, those need the full logs.
+	 */
+	if ((s->link.caps & CAP_SWEEP) && !kt_waveform_active(s) &&
+	    count > 1) {
+		entry = build(s, sig0, sig0_on_delay, sig0_off_delay,
+			      sig1, sig1_on_delay, sig1_off_delay,
+			      offset, width);
+		u = alloca(sizeof(int) * results * count);
+		if (!write_event(&s->link, s->eventbuf, entry) &&
+		    !run_sweep(&s->link, SWEEP_FIRST, (int)step, count,
+			       u, results)) {
+			for (n = 0; n < count; n++) {
+				decode_elements(s, &u[n * results],
+						result_str2, results);
+				if (!s->verbose &&
+				    !strcmp(result_str1, result_str2))
+					continue;
+				strcpy(result_str1, result_str2);
+				kt_report(s, test, label,
+					  n + 1, steps, result_str1);
+			}
+			return 0;
+		}
+
+		/* lost track of the device state, redo it probe by probe */
+		invalidate_link(&s->link);
+		if (set_log_window(s, DITDAH_LEN) < 0)
+			return -1;
+	}
+
+	u = alloca(sizeof(int) * results);
+	for (n = 1, i = offset; i < limit; n++, i += step) {
+		entry = build(s, sig0, sig0_on_delay, sig0_off_delay,
+			      sig1, sig1_on_delay, sig1_off_delay, i, width);
+		if (send_event_and_get_log(s, entry) < 0)
+			return -1;
+		parse_event(&s->unpacked_log[0], DITDAH_LEN, u, results);
+
+		decode_elements(s, u, result_str2, results);
+		if (!s->verbose && !strcmp(result_str1, result_str2)) continue;
+		strcpy(result_str1, result_str2);
+		kt_report(s, test, label, n, steps, result_str1);
+	}
+
+	return 0;
+}
+
+int kt_squeeze(struct kt_session *s)
+{
+	double width, offset, step, total;
+
+	offset = s->dit_total / (STEP * 4);
+	width = s->dit_total / (STEP * 2);
+	step = s->dit_total / STEP;
+	total = s->dit_total + s->dah_total;
+
+	kt_printf(s, "* squeeze\n");
+
+	if (sweep(s, "squeeze", "dit + dah", build_squeeze,
+		  DIT_BIT, s->calib_on_1, s->calib_off_1,
+		  DAH_BIT, s->calib_on_2, s->calib_off_2,
+		  offset, width, step, total * 2, (int)(total / step),
+		  SQ_RESULTS) < 0)
+		return -1;
+
+	return sweep(s, "squeeze", "dah + dit", build_squeeze,
+		     DAH_BIT, s->calib_on_2, s->calib_off_2,
+		     DIT_BIT, s->calib_on_1, s->calib_off_1,
+		     offset, width, step, total * 2, (int)(total / step),
+		     SQ_RESULTS);
+}
+
+int kt_simple(struct kt_session *s)
+{
+	double width, offset, step;
+
+	offset = s->dit_total / (STEP * 4);
+	width = s->dit_total / (STEP * 2);
+	step = s->dit_total / STEP;
+
+	kt_printf(s, "* simple\n");
+
+	if (sweep(s, "simple", "dit", build_ditdah_memory,
+		  DIT_BIT, s->calib_on_1, s->calib_off_1,
+		  0, s->calib_on_2, s->calib_off_2,
+		  offset, width, step, s->dit_total * 2,
+		  (int)(s->dit_total / step), RESULTS) < 0)
+		return -1;
+
+	return sweep(s, "simple", "dah", build_ditdah_memory,
+		     DAH_BIT, s->calib_on_2, s->calib_off_2,
+		     0, s->calib_on_1, s->calib_off_1,
+		     offset, width, step, s->dah_total * 2,
+		     (int)(s->dah_total / step), RESULTS);
+}
+
+int kt_ditdah_memory(struct kt_session *s)
+{
+	double width, offset, step;
+
+	offset = s->dit_total / (STEP * 4);
+	width = s->dit_total / (STEP * 2);
+	step = s->dit_total / STEP;
+
+	kt_printf(s, "* dit/dah memory (squeeze)\n");
+
+	if (sweep(s, "ditdah_memory", "dit on, dah", build_ditdah_memory,
+		  DIT_BIT, s->calib_on_1, s->calib_off_1,
+		  DAH_BIT, s->calib_on_2, s->calib_off_2,
+		  offset, width, step, s->dit_total * 2,
+		  (int)(s->dit_total / step), RESULTS) < 0)
+		return -1;
+
+	return sweep(s, "ditdah_memory", "dah on, dit", build_ditdah_memory,
+		     DAH_BIT, s->calib_on_2, s->calib_off_2,
+		     DIT_BIT, s->calib_on_1, s->calib_off_1,
+		     offset, width, step, s->dah_total * 2,
+		     (int)(s->dah_total / step), RESULTS);
+}
+
+int kt_ditdah_memory2(struct kt_session *s)
+{
+	double width, offset, step;
+
+	offset = s->dit_total / (STEP * 4);
+	width = s->dit_total / (STEP * 2);
+	step = s->dit_total / STEP;
+
+	kt_printf(s, "* dit/dah memory (non-squeeze)\n");
+
+	if (sweep(s, "ditdah_memory2", "dit -> dah", build_ditdah_memory2,
+		  DIT_BIT, s->calib_on_1, s->calib_off_1,
+		  DAH_BIT, s->calib_on_2, s->calib_off_2,
+		  offset, width, step, s->dit_total,
+		  (int)(s->dit_total / step), RESULTS) < 0)
+		return -1;
+
+	return sweep(s, "ditdah_memory2", "dah -> dit", build_ditdah_memory2,
+		     DAH_BIT, s->calib_on_2, s->calib_off_2,
+		     DIT_BIT, s->calib_on_1, s->calib_off_1,
+		     offset, width, step, s->dah_total,
+		     (int)(s->dah_total / step), RESULTS);
+}
+
+/* -1: element too long for the window, -2: device error */
+static int get_ditdah_length(struct kt_session *s, unsigned char mask, int *on_length, int *off_length)
+{
+	int i, n, u[RESULTS];
+	struct event *ev, *ev0;
+
+	if (set_log_window(s, DITDAH_LEN) < 0)
+		return -2;
+
+	ev = add_event_entry(ev0 = s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, DITDAH_POS, mask, EVT_SET);
+	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+	ev = add_event_entry(ev, DITDAH_LEN - 1, 0, EVT_SET);
+	if (send_event_and_get_log(s, ev - ev0) < 0)
+		return -2;
+
+	ev = &s->unpacked_log[0];
+	n = DITDAH_LEN;
+	if (parse_event(ev, n, u, RESULTS) < RESULTS)
+		return -1;
+
+	*on_length = *off_length = 0;
+	for (i = 0; i < RESULTS; i += 2) {
+		*on_length += u[i];
+		*off_length += u[i + 1];
+	}
+	*on_length /= (RESULTS / 2);
+	*off_length /= (RESULTS / 2);
+
+	return 0;
+}
+
+int kt_ditdah_length(struct kt_session *s)
+{
+	int err;
+
+	kt_printf(s, "* dit/dah length\n");
+
+	if ((err = get_ditdah_length(s, DIT_BIT,
+				     &s->dit_on, &s->dit_off)) < 0) {
+		if (err == -1) kt_printf(s, "dit too long\n");
+		return -1;
+	}
+
+	if ((err = get_ditdah_length(s, DAH_BIT,
+				     &s->dah_on, &s->dah_off)) < 0) {
+		if (err == -1) kt_printf(s, "dah too long\n");
+		return -1;
+	}
+
+	kt_printf(s, "dit: on=%d, off=%d, on/off=%.3f\n",
+		  s->dit_on, s->dit_off, (double)s->dit_on / s->dit_off);
+	kt_printf(s, "dah: on=%d, off=%d, on/off=%.3f\n",
+		  s->dah_on, s->dah_off, (double)s->dah_on / s->dah_off);
+	kt_printf(s, "dah/dit: %.3f\n", (double)s->dah_on / s->dit_on);
+
+	s->dit_total = s->dit_on + s->dit_off;
+	s->dah_total = s->dah_on + s->dah_off;
+
+	kt_printf(s, "dit: total=%d, total/on=%.3f, total/off=%.3f\n",
+		  s->dit_total, (double)s->dit_total / s->dit_on,
+		  (double)s->dit_total / s->dit_off);
+	kt_printf(s, "dah: total=%d, total/on=%.3f, total/off=%.3f\n",
+		  s->dah_total, (double)s->dah_total / s->dah_on,
+		  (double)s->dah_total / s->dah_off);
+	kt_printf(s, "dah total/dit total=%.3f\n",
+		  (double)s->dah_total / s->dit_total);
+
+	return 0;
+}
+
+static unsigned int stress_rand(unsigned int *state)
+{
+	/* xorshift32, reproducible for a given seed on any host */
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+
+	return *state;
+}
+
+static int stress_delay(struct kt_session *s, unsigned char bit, bool on)
+{
+	if (bit == DIT_BIT)
+		return on ? s->calib_on_1 : s->calib_off_1;
+	else
+		return on ? s->calib_on_2 : s->calib_off_2;
+}
+
+static int gen_stress_program(struct kt_session *s, unsigned int *seed, struct iambic_timing *tm, unsigned char *first, struct paddle_edge *edge, unsigned char *bit, char *expect, int *end)
+{
+	int i, j, k, n, horizon, try;
+	unsigned char v;
+
+	*first = (stress_rand(seed) & 1) ? DIT_BIT : DAH_BIT;
+	horizon = (stress_rand(seed) % (STRESS_ELEMENTS / 2) + 1) *
+		s->dit_total;
+	k = horizon / (tm->guard * 4);
+	k = stress_rand(seed) % ((k < STRESS_EDGES - 2) ? k : STRESS_EDGES - 2) + 1;
+
+	/* random single-paddle toggles, then release whatever is held */
+	for (i = 0, v = *first; i < k; i++) {
+		edge[i].pos = tm->guard + stress_rand(seed) % horizon;
+		bit[i] = (stress_rand(seed) & 1) ? DIT_BIT : DAH_BIT;
+	}
+	for (i = 1; i < k; i++) {
+		for (j = i; j > 0 && edge[j - 1].pos > edge[j].pos; j--) {
+			n = edge[j].pos;
+			edge[j].pos = edge[j - 1].pos;
+			edge[j - 1].pos = n;
+		}
+	}
+	for (i = 0; i < k; i++)
+		v ^= bit[i];
+	for (n = DIT_BIT; n <= DAH_BIT; n <<= 1) {
+		if (!(v & n)) continue;
+		edge[k].pos = edge[k - 1].pos + tm->guard +
+			stress_rand(seed) % s->dit_total;
+		bit[k++] = n;
+	}
+
+	/* move edges away from element boundaries, so that the result is defined */
+	for (try = 0; try < STRESS_EDGES; try++) {
+		for (i = 0, v = *first; i < k; i++)
+			edge[i].val = v ^= bit[i];
+
+		if ((n = iambic_model(tm, *first, edge, k, expect,
+				      STRESS_ELEMENTS, end, &i)) >= 0) {
+			/*
+			 * the model stops at the first idle gap, where both
+			 * paddles are released.  drop what follows, it would
+			 * start a new run that the model does not describe.
+			 */
+			while (k > 0 && edge[k - 1].pos > *end)
+				k--;
+			return k;
+		}
+		if (i < 0)
+			return -1;
+
+		edge[i].pos += tm->guard * 2;
+		for (j = i + 1; j < k && edge[j].pos < edge[j - 1].pos + 1; j++)
+			edge[j].pos = edge[j - 1].pos + 1;
+	}
+
+	return -1;
+}
+
+static int build_stress_program(struct kt_session *s, unsigned char first, struct paddle_edge *edge, unsigned char *bit, int k)
+{
+	int i, j, t, last[DAH_BIT + 1];
+	unsigned char v;
+	struct event *ev, *ev0, tmp;
+
+	ev = add_event_entry(ev0 = s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, DITDAH_POS, first, EVT_SET);
+	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+
+	/* keyer-side edge times to relay drive times, per paddle and level */
+	last[DIT_BIT] = last[DAH_BIT] = 0;
+	for (i = 0; i < k; i++) {
+		t = edge[i].pos - stress_delay(s, bit[i], edge[i].val & bit[i]);
+		if (t < 1) t = 1;
+		if (t <= last[bit[i]])
+			return -1; // relay delays would reorder this paddle
+		last[bit[i]] = t;
+		ev = add_event_entry(ev, t, bit[i], EVT_SET);
+	}
+
+	for (i = 4; i < ev - ev0; i++) {
+		for (j = i; j > 3 && ev0[j - 1].pos > ev0[j].pos; j--) {
+			tmp = ev0[j];
+			ev0[j] = ev0[j - 1];
+			ev0[j - 1] = tmp;
+		}
+	}
+
+	/* toggles to levels */
+	for (i = 3, v = first; i < ev - ev0; i++)
+		ev0[i].val = v ^= ev0[i].val;
+
+	return ev - ev0;
+}
+
+int kt_stress(struct kt_session *s, unsigned int seed, int count, char *logfile)
+{
+	char expect[STRESS_ELEMENTS + 1], result[STRESS_ELEMENTS + 1];
+	struct paddle_edge edge[STRESS_EDGES];
+	unsigned char bit[STRESS_EDGES], first;
+	struct iambic_timing tm;
+	struct timespec t0, t1;
+	unsigned int r;
+	int i, n, k, end, len, entry, u[STRESS_ELEMENTS * 2], run, fail, skip;
+	bool lost;
+	double elapsed;
+	FILE *fp;
+
+	if (!s->dit_total || !s->dah_total) {
+		if (kt_ditdah_length(s) < 0)
+			return -1;
+	}
+
+	if ((fp = fopen(logfile, "a")) == NULL) {
+		kt_printf(s, "cannot write %s\n", logfile);
+		return -1;
+	}
+
+	if (!seed) seed = 1;
+
+	tm.dit_on = s->dit_on;
+	tm.dit_off = s->dit_off;
+	tm.dah_on = s->dah_on;
+	tm.dah_off = s->dah_off;
+	tm.guard = s->dit_total / 8;
+
+	kt_printf(s, "* stress, seed=%u\n", seed);
+	fprintf(fp, "* stress, seed=%u, dit=%d/%d, dah=%d/%d\n",
+		seed, s->dit_on, s->dit_off, s->dah_on, s->dah_off);
+
+	run = fail = skip = 0;
+	lost = false;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < count; i++) {
+		/* every program is reproducible from seed and its number */
+		r = seed + i * 0x9e3779b9U;
+		if (!r) r = 1;
+
+		if ((k = gen_stress_program(s, &r, &tm, &first,
+					    edge, bit, expect, &end)) < 0 ||
+		    (len = (DITDAH_POS + end + s->dah_total * 2 + 0xff) & ~0xff)
+		    > MAX_POS ||
+		    (entry = build_stress_program(s, first, edge, bit, k)) < 0) {
+			skip++;
+			continue;
+		}
+
+		if (set_log_window(s, len) < 0 ||
+		    send_event_and_get_log(s, entry) < 0) {
+			lost = true;
+			break;
+		}
+		run++;
+
+		parse_event(s->unpacked_log, len, u, STRESS_ELEMENTS * 2);
+		for (n = 0; n < STRESS_ELEMENTS && u[n * 2] >= 0; n++)
+			result[n] = detect_element(s, u[n * 2]);
+		result[n] = '\0';
+
+		if (!strcmp(expect, result)) {
+			if (s->verbose) kt_printf(s, "%5d\t%s\n", i, result);
+			continue;
+		}
+
+		fail++;
+		kt_printf(s, "%5d\texpect %s\n\tresult %s\n", i, expect, result);
+		fprintf(fp, "program %d\nexpect %s\nresult %s\n",
+			i, expect, result);
+		for (n = 0; n < entry; n++)
+			fprintf(fp, "\t%5d %02x %d\n", s->eventbuf[n].pos,
+				s->eventbuf[n].val, s->eventbuf[n].evt);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	kt_printf(s, "programs: run=%d, mismatch=%d, skipped=%d\n",
+		  run, fail, skip);
+	kt_printf(s, "%.1f s, %.0f programs/hour\n",
+		  elapsed, elapsed > 0 ? run * 3600 / elapsed : 0);
+	fprintf(fp, "run=%d, mismatch=%d, skipped=%d\n", run, fail, skip);
+	fclose(fp);
+
+	if (fail)
+		kt_printf(s, "%s updated\n", logfile);
+
+	return lost ? -1 : fail;
+}
+
+static double elapsed_us(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e6 +
+		(t1->tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+/* what actually crossed the line, framing and escapes included */
+static unsigned long link_bytes(struct link *l)
+{
+	return l->txbytes + l->rxbytes;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report_benchmark(struct kt_session *s, char *name, int entry, int bytes, double *us)
+{
+	double mean;
+	int i;
+
+	qsort(us, BENCH_COUNT, sizeof(double), compare_double);
+	for (i = 0, mean = 0; i < BENCH_COUNT; i++)
+		mean += us[i];
+	mean /= BENCH_COUNT;
+
+	/* 8N1, 10 bits per byte on the line */
+	kt_printf(s, "%-8s %3d %4d  %8.0f %8.0f %8.0f %8.0f  %7.0f %5.1f%%\n",
+		  name, entry, bytes,
+		  us[BENCH_COUNT / 2], us[BENCH_COUNT * 9 / 10],
+		  us[BENCH_COUNT * 99 / 100], us[BENCH_COUNT - 1],
+		  bytes * 1e6 / mean,
+		  bytes * 1e6 / mean * 100 / (SERIAL_BAUD / 10));
+}
+
+int kt_benchmark(struct kt_session *s)
+{
+	static const int window[] = {0x1000, 0x2000, 0x4000, 0x8000, MAX_POS};
+	double us[BENCH_COUNT];
+	struct timespec t0, t1;
+	struct event *ev;
+	unsigned long bytes;
+	int i, j, n, resent, err = -1;
+
+	kt_printf(s, "* benchmark, %d baud (%d bytes/s), %d samples, %s\n",
+		  SERIAL_BAUD, SERIAL_BAUD / 10, BENCH_COUNT,
+		  s->link.framed ? "framed" : "unframed");
+	kt_printf(s, "         ent  byte   p50[us]  p90[us]  p99[us]  max[us]"
+		  "      B/s  line\n");
+
+	resent = s->link.resent;
+
+	bytes = link_bytes(&s->link);
+	for (i = 0; i < BENCH_COUNT; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (ping_device(&s->link) < 0)
+			goto fin;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		us[i] = elapsed_us(&t0, &t1);
+	}
+	report_benchmark(s, "ping", 0,
+			 (link_bytes(&s->link) - bytes) / BENCH_COUNT, us);
+
+	/* harmless program, all paddles kept released */
+	for (ev = s->eventbuf, i = 0; i < MAX_ENTRY; i++)
+		ev = add_event_entry(ev, i, 0, EVT_SET);
+
+	for (n = 1; n <= MAX_ENTRY; n *= 2) {
+		bytes = link_bytes(&s->link);
+		for (i = 0; i < BENCH_COUNT; i++) {
+			invalidate_link(&s->link); // full upload every time
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			if (write_event(&s->link, s->eventbuf, n) < 0)
+				goto fin;
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			us[i] = elapsed_us(&t0, &t1);
+		}
+		report_benchmark(s, "upload", n, (link_bytes(&s->link) - bytes) /
+				 BENCH_COUNT, us);
+	}
+
+	/* hold dit for the whole window, longer window gives more entries */
+	for (j = 0; j < sizeof(window) / sizeof(window[0]); j++) {
+		ev = add_event_entry(s->eventbuf, 0, 0, EVT_SET);
+		ev = add_event_entry(ev, 0x100, DIT_BIT, EVT_SET);
+		if (set_maxpos(&s->link, window[j]) < 0 ||
+		    write_event(&s->link, s->eventbuf, ev - s->eventbuf) < 0 ||
+		    start_log(&s->link) < 0)
+			goto fin;
+
+		bytes = link_bytes(&s->link);
+		for (i = 0; i < BENCH_COUNT; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			if ((n = read_log(&s->link, s->packed_log,
+					  MAX_ENTRY)) < 0)
+				goto fin;
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			us[i] = elapsed_us(&t0, &t1);
+		}
+		report_benchmark(s, "readback", n, (link_bytes(&s->link) -
+						    bytes) / BENCH_COUNT, us);
+	}
+
+	ev = add_event_entry(s->eventbuf, 0, 0, EVT_SET);
+	if (write_event(&s->link, s->eventbuf, ev - s->eventbuf) < 0)
+		goto fin;
+
+	err = 0;
+
+fin:
+	if (err)
+		kt_printf(s, "device not responding\n");
+	kt_printf(s, "retransmitted frames: %d\n", s->link.resent - resent);
+
+	return err;
+}
+
+struct monitor {
+	unsigned long t, rise, fall, press;
+	unsigned short pos;
+	unsigned char val;
+	bool started;
+	char elements[MON_ELEMENTS + 1];
+	int n, last_on;
+	char last;
+	double dit_on, dit_off, dah_on, dah_off;
+	int latency;
+};
+
+static void average(double *avg, int v)
+{
+	*avg = *avg ? (*avg * 3 + v) / 4 : v;
+}
+
+static void monitor_flush(struct kt_session *s, struct monitor *m)
+{
+	if (!m->n)
+		return;
+
+	kt_printf(s, "\t dit %.0f/%.0f, dah %.0f/%.0f, on/off %.2f/%.2f, "
+		  "dah/dit %.2f, weight %.1f%%, latency %d\n",
+		  m->dit_on, m->dit_off, m->dah_on, m->dah_off,
+		  m->dit_off ? m->dit_on / m->dit_off : 0,
+		  m->dah_off ? m->dah_on / m->dah_off : 0,
+		  m->dit_on ? m->dah_on / m->dit_on : 0,
+		  (m->dit_on + m->dit_off) ?
+		  m->dit_on * 100 / (m->dit_on + m->dit_off) : 0,
+		  m->latency);
+	m->n = 0;
+}
+
+/* with the measured timing, the dit length decides; else follow the operator */
+static double monitor_dit(struct kt_session *s, struct monitor *m)
+{
+	return s->dit_total ? s->dit_total / 2 : m->dit_on;
+}
+
+/* idle long enough at tick t: the character is complete */
+static void monitor_idle(struct kt_session *s, struct monitor *m, unsigned long t)
+{
+	double dit;
+
+	dit = monitor_dit(s, m);
+	if (!(m->val & MON_OUT) && m->fall && dit && t - m->fall > dit * 3)
+		monitor_flush(s, m);
+}
+
+static void monitor_event(struct kt_session *s, struct monitor *m, struct event *ev)
+{
+	unsigned char changed;
+	double dit;
+	int v;
+
+	if (!m->started) {
+		m->started = true;
+		m->pos = ev->pos;
+		m->val = ev->val;
+		return;
+	}
+
+	m->t += (unsigned short)(ev->pos - m->pos);
+	m->pos = ev->pos;
+	changed = m->val ^ ev->val;
+	m->val = ev->val;
+
+	dit = monitor_dit(s, m);
+
+	/* paddle to OUT latency, only when the keyer is idle */
+	if ((changed & (MON_DIT | MON_DAH)) &&
+	    (m->val & (MON_DIT | MON_DAH)) && !(m->val & MON_OUT) &&
+	    !m->press && (!m->fall || m->t - m->fall > dit * 2))
+		m->press = m->t;
+
+	if (changed & MON_OUT) {
+		if (m->val & MON_OUT) {
+			if (m->fall) {
+				v = m->t - m->fall;
+				if (dit && v > dit * 2)
+					monitor_flush(s, m);
+				else if (m->last == '.')
+					average(&m->dit_off, v);
+				else
+					average(&m->dah_off, v);
+			}
+			if (m->press) {
+				m->latency = m->t - m->press;
+				m->press = 0;
+			}
+			m->rise = m->t;
+		} else if (m->rise) {
+			v = m->t - m->rise;
+			if (s->dit_total) {
+				m->last = detect_element(s, v);
+			} else {
+				/*
+				 * the shortest mark is the dit.  one well
+				 * below the estimate means that a dah
+				 * seeded it, start over from this mark.
+				 */
+				if (!m->dit_on || v * 2 < m->dit_on) {
+					m->dah_on = m->dit_on;
+					m->dit_on = v;
+				}
+				m->last = (v < m->dit_on * 2) ? '.' : '-';
+			}
+			if (m->last == '.')
+				average(&m->dit_on, v);
+			else
+				average(&m->dah_on, v);
+
+			if (m->n < MON_ELEMENTS) {
+				m->elements[m->n++] = m->last;
+				kt_printf(s, "%c", m->last);
+			}
+			m->fall = m->t;
+		}
+	}
+
+	monitor_idle(s, m, m->t);
+}
+
+/*
+ * live monitor, runs until stop() returns true.  events are read into a
+ * fixed ring, decoded as they arrive, and elements are printed as soon
+ * as OUT goes off.
+ */
+int kt_monitor(struct kt_session *s, bool (*stop)(void *), void *arg)
+{
+	struct monitor m;
+	struct timespec last, now;
+	unsigned int head;
+	int n;
+
+	if (start_monitor(&s->link) < 0) {
+		kt_printf(s, "device does not support monitor mode\n");
+		return -1;
+	}
+
+	memset(&m, 0, sizeof(m));
+	s->mon_head = s->mon_tail = 0;
+
+	kt_printf(s, "* monitor\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	while (!stop(arg)) {
+		/* contiguous free space up to the end of the ring */
+		head = s->mon_head & (MON_RING - 1);
+		n = MON_RING - head;
+		if (n > MON_RING - (s->mon_head - s->mon_tail))
+			n = MON_RING - (s->mon_head - s->mon_tail);
+
+		if ((n = read_monitor(&s->link, &s->mon_ring[head],
+				      n, MON_POLL)) < 0)
+			break;
+		s->mon_head += n;
+
+		/* nothing for a while, the last character may be complete */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (n)
+			last = now;
+		else
+			monitor_idle(s, &m, m.t + elapsed_us(&last, &now) *
+				     1000 / TICK_NS);
+
+		while (s->mon_tail != s->mon_head) {
+			monitor_event(s, &m, &s->mon_ring[s->mon_tail &
+							  (MON_RING - 1)]);
+			s->mon_tail++;
+		}
+	}
+
+	monitor_flush(s, &m);
+
+	return stop_monitor(&s->link);
+}
+
+static int find_relay_delay(struct kt_session *s, int pos, unsigned char mask, bool state)
+{
+	int n;
+	struct event *ev;
+
+	ev = &s->unpacked_log[pos];
+	n = CALIB_LEN - pos;
+	if ((ev = find_event_entry(ev, &n, mask, state ? mask : 0)) != NULL)
+		return ev->pos - pos;
+
+	return -1;
+}
+
+/* -1: relay did not switch within the window, -2: device error */
+static int get_calibration_value(struct kt_session *s, unsigned char mask, bool state)
+{
+	struct event *ev;
+
+	if (set_log_window(s, CALIB_LEN) < 0)
+		return -2;
+
+	ev = add_event_entry(s->eventbuf, 0, state ? 0 : mask, EVT_SET);
+	ev = add_event_entry(ev, CALIB_POS, state ? mask : 0, EVT_SET);
+	if (send_event_and_get_log(s, 2) < 0)
+		return -2;
+
+	return find_relay_delay(s, CALIB_POS, mask, state);
+}
+
+static int add_calibration_value(struct kt_session *s, int *sum, unsigned char mask, bool state)
+{
+	int v;
+
+	/* a missed edge would drag the average, reject the whole run */
+	if ((v = get_calibration_value(s, mask, state)) < 0) {
+		if (v == -1)
+			kt_printf(s, "relay_%d did not switch %s\n",
+				  (mask == DIT_BIT) ? 1 : 2,
+				  state ? "on" : "off");
+		return -1;
+	}
+
+	*sum += v;
+
+	return 0;
+}
+
+int kt_calibrate(struct kt_session *s)
+{
+#define CALIBRATION_TRY 4
+
+	struct kt_calibration c;
+	int i;
+
+	c.on_1 = c.off_1 = c.on_2 = c.off_2 = 0;
+
+	/* the stored calibration is kept unless every sample is valid */
+	for (i = 0; i < CALIBRATION_TRY; i++) {
+		if (add_calibration_value(s, &c.on_1, DIT_BIT, true) < 0 ||
+		    add_calibration_value(s, &c.off_1, DIT_BIT, false) < 0 ||
+		    add_calibration_value(s, &c.on_2, DAH_BIT, true) < 0 ||
+		    add_calibration_value(s, &c.off_2, DAH_BIT, false) < 0)
+			return -1;
+	}
+
+	s->calib_on_1 = c.on_1 / CALIBRATION_TRY;
+	s->calib_off_1 = c.off_1 / CALIBRATION_TRY;
+	s->calib_on_2 = c.on_2 / CALIBRATION_TRY;
+	s->calib_off_2 = c.off_2 / CALIBRATION_TRY;
+
+	return 0;
+}
+
+/* all four relay delays from one capture, both relays switched together */
+int kt_check_calibration(struct kt_session *s, struct kt_calibration *c)
+{
+	struct event *ev;
+
+	if (set_log_window(s, CALIB_LEN) < 0)
+		return -1;
+
+	ev = add_event_entry(s->eventbuf, 0, 0, EVT_SET);
+	ev = add_event_entry(ev, CALIB_POS, DIT_BIT | DAH_BIT, EVT_SET);
+	ev = add_event_entry(ev, CALIB_POS * 2, 0, EVT_SET);
+	if (send_event_and_get_log(s, ev - s->eventbuf) < 0)
+		return -1;
+
+	c->on_1 = find_relay_delay(s, CALIB_POS, DIT_BIT, true);
+	c->on_2 = find_relay_delay(s, CALIB_POS, DAH_BIT, true);
+	c->off_1 = find_relay_delay(s, CALIB_POS * 2, DIT_BIT, false);
+	c->off_2 = find_relay_delay(s, CALIB_POS * 2, DAH_BIT, false);
+
+	if (c->on_1 < 0 || c->on_2 < 0 || c->off_1 < 0 || c->off_2 < 0)
+		return -1;
+
+	return 0;
+}
+
+void kt_set_verbose(struct kt_session *s, bool verbose)
+{
+	s->verbose = verbose;
+}
+
+bool kt_get_verbose(struct kt_session *s)
+{
+	return s->verbose;
+}
+
+void kt_set_calibration(struct kt_session *s, struct kt_calibration *c)
+{
+	s->calib_on_1 = c->on_1;
+	s->calib_off_1 = c->off_1;
+	s->calib_on_2 = c->on_2;
+	s->calib_off_2 = c->off_2;
+}
+
+void kt_get_calibration(struct kt_session *s, struct kt_calibration *c)
+{
+	c->on_1 = s->calib_on_1;
+	c->off_1 = s->calib_off_1;
+	c->on_2 = s->calib_on_2;
+	c->off_2 = s->calib_off_2;
+}
+
+void kt_get_timing(struct kt_session *s, struct kt_timing *t)
+{
+	t->dit_on = s->dit_on;
+	t->dit_off = s->dit_off;
+	t->dah_on = s->dah_on;
+	t->dah_off = s->dah_off;
+}
+
+int kt_waveform_start(struct kt_session *s, char *filename, char *select)
+{
+	if (s->vcd.fp != NULL)
+		vcd_close(&s->vcd);
+
+	return vcd_open(&s->vcd, filename, select);
+}
+
+int kt_waveform_stop(struct kt_session *s)
+{
+	vcd_close(&s->vcd);
+
+	return s->vcd.probe;
+}
+
+bool kt_waveform_active(struct kt_session *s)
+{
+	return s->vcd.fp != NULL;
+}
+
+struct kt_session *kt_new(struct kt_callbacks *cb)
+{
+	struct kt_session *s;
+
+	if ((s = calloc(1, sizeof(*s))) == NULL)
+		return NULL;
+
+	init_link(&s->link, -1);
+	s->log_len = MAX_POS;
+	if (cb != NULL)
+		s->cb = *cb;
+
+	return s;
+}
+
+void kt_free(struct kt_session *s)
+{
+	if (s == NULL)
+		return;
+
+	kt_close(s);
+	free(s);
+}
+
+int kt_device_id(char *serdev, char *buf, int size)
+{
+	return get_serial_id(serdev, buf, size);
+}
+
+int kt_open(struct kt_session *s, char *serdev)
+{
+	int fd, err;
+
+	if ((fd = open_serial(serdev)) < 0)
+		return KT_ERR_OPEN;
+
+	init_link(&s->link, fd);
+	if ((err = wait_for_device(fd)) < 0) {
+		if (err == SERIAL_ERR_NONBLOCK)
+			kt_printf(s, "non-block mode set failed\n");
+		kt_close(s);
+		return KT_ERR_NOT_READY;
+	}
+
+	negotiate_link(&s->link);
+
+	return 0;
+}
+
+void kt_close(struct kt_session *s)
+{
+	vcd_close(&s->vcd);
+
+	if (s->link.fd >= 0)
+		close(s->link.fd);
+	init_link(&s->link, -1);
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#ifndef KEYERTEST_H
+#define KEYERTEST_H
+
+#include <stdbool.h>
+
+struct kt_session;
+
+struct kt_calibration {
+	int on_1, off_1;	/* relay_1 (dit) */
+	int on_2, off_2;	/* relay_2 (dah) */
+};
+
+struct kt_timing {
+	int dit_on, dit_off;
+	int dah_on, dah_off;
+};
+
+struct kt_result {
+	const char *test;
+	const char *label;
+	int step, steps;
+	const char *elements;
+};
+
+struct kt_callbacks {
+	void (*message)(void *, const char *);
+	void (*result)(void *, const struct kt_result *);
+	void *arg;
+};
+
+/* the library is built with -fvisibility=hidden, only kt_* is exported */
+#define KT_API __attribute__((visibility("default")))
+
+#define KT_ERR_OPEN (-1)
+#define KT_ERR_NOT_READY (-2)
+
+KT_API struct kt_session *kt_new(struct kt_callbacks *);
+KT_API void kt_free(struct kt_session *);
+KT_API int kt_open(struct kt_session *, char *);
+KT_API void kt_close(struct kt_session *);
+
+KT_API void kt_set_verbose(struct kt_session *, bool);
+KT_API bool kt_get_verbose(struct kt_session *);
+KT_API void kt_set_calibration(struct kt_session *, struct kt_calibration *);
+KT_API void kt_get_calibration(struct kt_session *, struct kt_calibration *);
+KT_API void kt_get_timing(struct kt_session *, struct kt_timing *);
+
+KT_API int kt_waveform_start(struct kt_session *, char *, char *);
+KT_API int kt_waveform_stop(struct kt_session *);
+KT_API bool kt_waveform_active(struct kt_session *);
+
+KT_API int kt_device_id(char *, char *, int);
+KT_API int kt_calibrate(struct kt_session *);
+KT_API int kt_check_calibration(struct kt_session *, struct kt_calibration *);
+KT_API int kt_ditdah_length(struct kt_session *);
+KT_API int kt_simple(struct kt_session *);
+KT_API int kt_ditdah_memory(struct kt_session *);
+KT_API int kt_ditdah_memory2(struct kt_session *);
+KT_API int kt_squeeze(struct kt_session *);
+KT_API int kt_stress(struct kt_session *, unsigned int, int, char *);
+KT_API int kt_benchmark(struct kt_session *);
+KT_API int kt_monitor(struct kt_session *, bool (*)(void *), void *);
+
+#endif
@@ -6,32 +6,15 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
-#include "serial.h"
-#include "event.h"
-#include "keyer-test-arduino.h"
+#include <time.h>
+#include <poll.h>
+#include "keyertest.h"
 
 #define CONFIG_FILE "keyer-test.cfg"
-#define DIT_BIT 0x01
-#define DAH_BIT 0x02
-#define OUT_BIT 0x01
-
-static struct event unpacked_log[MAX_POS];
-static struct event packed_log[MAX_ENTRY];
-static int packed_log_entry;
-static struct event eventbuf[MAX_ENTRY];
-static int calib_on_1 = 0, calib_off_1 = 0 , calib_on_2 = 0, calib_off_2 = 0;
-static int dit_on = 0, dit_off = 0, dah_on = 0, dah_off = 0;
-static int dit_total = 0, dah_total = 0;
-static bool verbose = false;
-
-#define DITDAH_LEN 0x8000
-#define DITDAH_POS 0x2000
-
-#define CALIB_LEN 0x2000
-#define CALIB_POS 0x0800
-
-#define STEP 4
-#define RESULTS 8
+#define PROFILE_FILE "keyer-test-profile.cfg"
+#define DRIFT_TOLERANCE 10	/* percent of the stored delay */
+#define DRIFT_MIN 2		/* ticks, for very short delays */
+#define STRESS_LOG "keyer-test-stress.log"
 
 //#define DEBUG
 #ifdef DEBUG
@@ -40,480 +23,257 @@ static bool verbose = false;
 #define DEBUG_PRINT(x) /* */
 #endif
 
-
-static void send_event_and_get_log(int fd, int event_entry)
+static void print_message(void *arg, const char *str)
 {
-	write_event(fd, eventbuf, event_entry);
-	start_log(fd);
-	packed_log_entry = read_log(fd, packed_log, MAX_POS);
-	unpack_events(unpacked_log, MAX_POS, packed_log, packed_log_entry);
+	fputs(str, stdout);
+	fflush(stdout);
 }
 
-static int parse_event(struct event *ev, int entry, int *out, int size)
+static void print_result(void *arg, const struct kt_result *r)
 {
-	int i, j, n, t0, t1;
-
-	/*
-	 *    t[0]     t[1]     t[2]     t[3]     t[4]     t[5]     t[6]
-	 *     :        :        :        :        :        :        :
-	 *     +--------+        +--------+        +--------+        +---- 
-	 *     |        |        |        |        |        |        |
-	 * ----+        +--------+        +--------+        +--------+
-	 *     :        :        :        :        :        :        :
-	 *     |<-u[0]->|<-u[1]->|<-u[2]->|<-u[3]->|<-u[4]->|<-u[5]->|
-	 */
-
-	n = entry;
-	for (i = j = 0; i < size + 1; i++) {
-		if ((ev = find_event_entry(ev, &n, OUT_BIT,
-					   (i & 1) ? 0 : OUT_BIT)) == NULL)
-			break;
+	/* simple sends 1..step elements, the others a single one at step */
+	printf("%s %s%2d/%2d\t%s\n", r->label,
+	       strcmp(r->test, "simple") ? "" : "1-",
+	       r->step, r->steps, r->elements);
+}
 
-		t1 = ev->pos;
-		if (i) out[j++] = t1 - t0;
-		t0 = t1;
+static int load_config(struct kt_session *s)
+{
+	FILE *fp;
+	struct kt_calibration c;
 
-		ev++;
-		n--;
+	if ((fp = fopen(CONFIG_FILE, "r")) == NULL) {
+		printf(CONFIG_FILE " not found\n");
+		return -1;
 	}
-	for (i = j; i < size; i++) out[i] = -1;
 
-	DEBUG_PRINT(("#"));
-	for (i = 0; i < size; i++) DEBUG_PRINT((" %d", out[i]));
-	DEBUG_PRINT(("\n"));
+	memset(&c, 0, sizeof(c));
+	fscanf(fp, "%d %d %d %d", &c.on_1, &c.off_1, &c.on_2, &c.off_2);
+	fclose(fp);
+
+	kt_set_calibration(s, &c);
 
-	return j;
+	return 0;
 }
 
-static char detect_element(int v)
+static int save_config(struct kt_session *s)
 {
-#define RANGE 10
-#define DIFF(x, t) ((((x) - t) * 100) / (t))
-	
-	if (v < 0) return ' ';
-	else if (DIFF(v, dit_total / 2) >= -10 &&
-		 DIFF(v, dit_total / 2) <= 10) return '.';
-	else return '-';
-}
+	FILE *fp;
+	struct kt_calibration c;
 
-static char *check_squeeze(int fd, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width, char *result_str, int results)
-{
-	int n, t0, t1, m, *u;
-	struct event *ev, *ev0;
-
-	set_maxpos(fd, DITDAH_LEN);
-
-	ev = add_event_entry(ev0 = eventbuf, 0, 0, EVT_SET);
-	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
-	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
-	ev = add_event_entry(ev, 1, sig0 | sig1, EVT_SET);
-
-	t0 = offset + width - sig0_off_delay;
-	t1 = offset + width - sig1_off_delay;
-	if (!sig1 || t0 == t1) {
-		// no sig1, or sig0 and sig1 same timing
-		m = 0;
-	} else if (t0 < t1) {
-		// sig0 first
-		m = sig1;
-	} else {
-		// sig1 first
-		m = sig0;
-		n = t1;
-		t1 = t0;
-		t0 = n;
+	if ((fp = fopen(CONFIG_FILE, "w")) == NULL) {
+		printf("cannot write " CONFIG_FILE "\n");
+		return -1;
 	}
-	ev = add_event_entry(ev, t0, m, EVT_SET);
-	if (m)
-		ev = add_event_entry(ev, t1, 0, EVT_SET);
-
-	send_event_and_get_log(fd, ev - ev0);
 
-	ev = &unpacked_log[0];
-	n = DITDAH_LEN;
-	u = alloca(sizeof(int) * results);
-	parse_event(ev, n, u, results);
-
-	for (n = 0; n < results / 2; n++)
-		result_str[n] = detect_element(u[n * 2]);
-	result_str[n] = '\0';
+	kt_get_calibration(s, &c);
+	fprintf(fp, "%d %d %d %d\n", c.on_1, c.off_1, c.on_2, c.off_2);
+	fclose(fp);
 
-	return result_str;
+	return 0;
 }
 
-static void do_squeeze(int fd)
+/* one line per device: id on_1 off_1 on_2 off_2 */
+static int load_profile(struct kt_session *s, char *id)
 {
-#define SQ_RESULTS 10
-
-	int n;
-	double i, width, offset, step, total;
-	char result_str1[SQ_RESULTS / 2 + 1], result_str2[SQ_RESULTS / 2 + 1];
-
-	offset = dit_total / (STEP * 4);
-	width = dit_total / (STEP * 2);
-	step = dit_total / STEP;
-	total = dit_total + dah_total;
-
-	printf("* squeeze\n");
-
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < total * 2; n++, i += step) {
-		check_squeeze(fd,
-			      DIT_BIT, calib_on_1, calib_off_1,
-			      DAH_BIT, calib_on_2, calib_off_2,
-			      i, width, result_str2, SQ_RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dit + dah %2d/%2d\t%s\n",
-		       n, (int)(total / step), result_str1);
-	}
+	FILE *fp;
+	char buf[512], name[256];
+	struct kt_calibration c;
+	int found = -1;
+
+	if ((fp = fopen(PROFILE_FILE, "r")) == NULL)
+		return -1;
 
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < total * 2; n++, i += step) {
-		check_squeeze(fd,
-			      DAH_BIT, calib_on_2, calib_off_2,
-			      DIT_BIT, calib_on_1, calib_off_1,
-			      i, width, result_str2, SQ_RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dah + dit %2d/%2d\t%s\n",
-		       n, (int)(total / step), result_str1);
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (sscanf(buf, "%255s %d %d %d %d", name,
+			   &c.on_1, &c.off_1, &c.on_2, &c.off_2) != 5 ||
+		    strcmp(name, id))
+			continue;
+		kt_set_calibration(s, &c);
+		found = 0;
+		break;
 	}
+	fclose(fp);
+
+	return found;
 }
 
-static char *check_ditdah_memory(int fd, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width, char *result_str, int results)
+static int save_profile(struct kt_session *s, char *id)
 {
-	int n, t0, t1, m, *u;
-	struct event *ev, *ev0;
-
-	set_maxpos(fd, DITDAH_LEN);
-
-	ev = add_event_entry(ev0 = eventbuf, 0, 0, EVT_SET);
-	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
-	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
-	ev = add_event_entry(ev, 1, sig0, EVT_SET);
-	if (sig1) {
-		ev = add_event_entry(ev, offset - sig1_on_delay,
-				     sig0 | sig1, EVT_SET);
-	}
+	FILE *fp, *tmp;
+	char buf[512], name[256];
+	struct kt_calibration c;
 
-	t0 = offset + width - sig0_off_delay;
-	t1 = offset + width - sig1_off_delay;
-	if (!sig1 || t0 == t1) {
-		// no sig1, or sig0 and sig1 same timing
-		m = 0;
-	} else if (t0 < t1) {
-		// sig0 first
-		m = sig1;
-	} else {
-		// sig1 first
-		m = sig0;
-		n = t1;
-		t1 = t0;
-		t0 = n;
+	if ((tmp = fopen(PROFILE_FILE ".tmp", "w")) == NULL) {
+		printf("cannot write " PROFILE_FILE "\n");
+		return -1;
 	}
-	ev = add_event_entry(ev, t0, m, EVT_SET);
-	if (m)
-		ev = add_event_entry(ev, t1, 0, EVT_SET);
-
-	send_event_and_get_log(fd, ev - ev0);
 
-	ev = &unpacked_log[0];
-	n = DITDAH_LEN;
-	u = alloca(sizeof(int) * results);
-	parse_event(ev, n, u, results);
+	/* keep the other devices */
+	if ((fp = fopen(PROFILE_FILE, "r")) != NULL) {
+		while (fgets(buf, sizeof(buf), fp) != NULL) {
+			if (sscanf(buf, "%255s", name) == 1 &&
+			    !strcmp(name, id))
+				continue;
+			fputs(buf, tmp);
+		}
+		fclose(fp);
+	}
 
-	for (n = 0; n < results / 2; n++)
-		result_str[n] = detect_element(u[n * 2]);
-	result_str[n] = '\0';
+	kt_get_calibration(s, &c);
+	fprintf(tmp, "%s %d %d %d %d\n",
+		id, c.on_1, c.off_1, c.on_2, c.off_2);
+	fclose(tmp);
 
-	return result_str;
+	return rename(PROFILE_FILE ".tmp", PROFILE_FILE);
 }
 
-static char *check_ditdah_memory2(int fd, unsigned char sig0, int sig0_on_delay, int sig0_off_delay, unsigned char sig1, int sig1_on_delay, int sig1_off_delay, int offset, int width, char *result_str, int results)
+static bool drifted(int ref, int v)
 {
-	int n, *u;
-	struct event *ev, *ev0;
-
-	set_maxpos(fd, DITDAH_LEN);
-
-	ev = add_event_entry(ev0 = eventbuf, 0, 0, EVT_SET);
-	ev = add_event_entry(ev, DITDAH_POS, sig0, EVT_SET);
-	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
+	int d;
 
-	// different from check_ditdah_memory(), non-squeeze
-	ev = add_event_entry(ev, 1, 0, EVT_SET);
-	ev = add_event_entry(ev, offset - sig1_on_delay, sig1, EVT_SET);
-	ev = add_event_entry(ev, offset + width - sig1_off_delay, 0, EVT_SET);
+	d = (ref * DRIFT_TOLERANCE) / 100;
+	if (d < DRIFT_MIN) d = DRIFT_MIN;
 
-	send_event_and_get_log(fd, ev - ev0);
-
-	ev = &unpacked_log[0];
-	n = DITDAH_LEN;
-	u = alloca(sizeof(int) * results);
-	parse_event(ev, n, u, results);
-
-	for (n = 0; n < results / 2; n++)
-		result_str[n] = detect_element(u[n * 2]);
-	result_str[n] = '\0';
-
-	return result_str;
+	return v < ref - d || v > ref + d;
 }
 
-static void do_simple(int fd)
+static void check_profile(struct kt_session *s, char *id)
 {
-	int n;
-	double i, width, offset, step;
-	char result_str1[RESULTS / 2 + 1], result_str2[RESULTS / 2 + 1];
-
-	offset = dit_total / (STEP * 4);
-	width = dit_total / (STEP * 2);
-	step = dit_total / STEP;
-
-	printf("* simple\n");
-
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dit_total * 2; n++, i += step) {
-		check_ditdah_memory(fd,
-				    DIT_BIT, calib_on_1, calib_off_1,
-				    0, calib_on_2, calib_off_2,
-				    i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dit 1-%2d/%2d\t%s\n",
-		       n, (int)(dit_total / step), result_str1);
+	struct kt_calibration c, m;
+	char buf[64];
+	bool fallback = false;
+
+	if (load_profile(s, id) < 0) {
+		printf("no profile for %s\n", id);
+		if (load_config(s) < 0) {
+			/* nothing to check against */
+			printf("calibrating %s\n", id);
+			if (kt_calibrate(s) < 0) {
+				printf("calibration failed, use 'c' "
+				       "before testing\n");
+				return;
+			}
+			save_profile(s, id);
+			return;
+		}
+		fallback = true;
 	}
 
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dah_total * 2; n++, i += step) {
-		check_ditdah_memory(fd,
-				    DAH_BIT, calib_on_2, calib_off_2,
-				    0, calib_on_1, calib_off_1,
-				    i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dah 1-%2d/%2d\t%s\n",
-		       n, (int)(dah_total / step), result_str1);
-	}
-}
-
-static void do_ditdah_memory(int fd)
-{
-	int n;
-	double i, width, offset, step;
-	char result_str1[RESULTS / 2 + 1], result_str2[RESULTS / 2 + 1];
-
-	offset = dit_total / (STEP * 4);
-	width = dit_total / (STEP * 2);
-	step = dit_total / STEP;
-
-	printf("* dit/dah memory (squeeze)\n");
-
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dit_total * 2; n++, i += step) {
-		check_ditdah_memory(fd,
-				    DIT_BIT, calib_on_1, calib_off_1,
-				    DAH_BIT, calib_on_2, calib_off_2,
-				    i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dit on, dah %2d/%2d\t%s\n",
-		       n, (int)(dit_total / step), result_str1);
+	kt_get_calibration(s, &c);
+	if (kt_check_calibration(s, &m) < 0) {
+		printf("relay check failed, keeping profile %s\n", id);
+		return;
 	}
 
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dah_total * 2; n++, i += step) {
-		check_ditdah_memory(fd,
-				    DAH_BIT, calib_on_2, calib_off_2,
-				    DIT_BIT, calib_on_1, calib_off_1,
-				    i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dah on, dit %2d/%2d\t%s\n",
-		       n, (int)(dah_total / step), result_str1);
+	if (!drifted(c.on_1, m.on_1) && !drifted(c.off_1, m.off_1) &&
+	    !drifted(c.on_2, m.on_2) && !drifted(c.off_2, m.off_2)) {
+		printf("profile %s ok\n", id);
+		if (fallback)
+			save_profile(s, id);
+		return;
 	}
-}
 
-static void do_ditdah_memory2(int fd)
-{
-	int n;
-	double i, width, offset, step;
-	char result_str1[RESULTS / 2 + 1], result_str2[RESULTS / 2 + 1];
-
-	offset = dit_total / (STEP * 4);
-	width = dit_total / (STEP * 2);
-	step = dit_total / STEP;
-
-	printf("* dit/dah memory (non-squeeze)\n");
-
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dit_total; n++, i += step) {
-		check_ditdah_memory2(fd,
-				     DIT_BIT, calib_on_1, calib_off_1,
-				     DAH_BIT, calib_on_2, calib_off_2,
-				     i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dit -> dah %2d/%2d\t%s\n",
-		       n, (int)(dit_total / step), result_str1);
+	/* a bad wire or a stuck relay looks the same, let the user decide */
+	printf("relay delays moved for %s\n", id);
+	printf("relay_1: on=%d->%d, off=%d->%d\n",
+	       c.on_1, m.on_1, c.off_1, m.off_1);
+	printf("relay_2: on=%d->%d, off=%d->%d\n",
+	       c.on_2, m.on_2, c.off_2, m.off_2);
+	printf("recalibrate and save? (y/N) -> ");
+	if (fgets(buf, sizeof(buf), stdin) == NULL ||
+	    (*buf != 'y' && *buf != 'Y')) {
+		printf("keeping profile %s\n", id);
+		return;
 	}
 
-	memset(result_str1, 0, sizeof(result_str1));
-	for (n = 1, i = offset; i < dah_total; n++, i += step) {
-		check_ditdah_memory2(fd,
-				     DAH_BIT, calib_on_2, calib_off_2,
-				     DIT_BIT, calib_on_1, calib_off_1,
-				     i, width, result_str2, RESULTS);
-		if (!verbose && !strcmp(result_str1, result_str2)) continue;
-		strcpy(result_str1, result_str2);
-		printf("dah -> dit %2d/%2d\t%s\n",
-		       n, (int)(dah_total / step), result_str1);
+	if (kt_calibrate(s) < 0) {
+		printf("calibration failed, keeping profile %s\n", id);
+		return;
 	}
+	save_profile(s, id);
 }
 
-static int get_ditdah_length(int fd, unsigned char mask, int *on_length, int *off_length)
+static void disp_config(struct kt_session *s)
 {
-	int i, n, u[RESULTS];
-	struct event *ev, *ev0;
+	struct kt_calibration c;
 
-	set_maxpos(fd, DITDAH_LEN);
-
-	ev = add_event_entry(ev0 = eventbuf, 0, 0, EVT_SET);
-	ev = add_event_entry(ev, DITDAH_POS, mask, EVT_SET);
-	ev = add_event_entry(ev, 0, OUT_BIT, EVT_CHGSTS);
-	ev = add_event_entry(ev, DITDAH_LEN - 1, 0, EVT_SET);
-	send_event_and_get_log(fd, ev - ev0);
-
-	ev = &unpacked_log[0];
-	n = DITDAH_LEN;
-	if (parse_event(ev, n, u, RESULTS) < RESULTS)
-		return -1;
-
-	*on_length = *off_length = 0;
-	for (i = 0; i < RESULTS; i += 2) {
-		*on_length += u[i];
-		*off_length += u[i + 1];
-	}
-	*on_length /= (RESULTS / 2);
-	*off_length /= (RESULTS / 2);
-
-	return 0;
+	kt_get_calibration(s, &c);
+	DEBUG_PRINT(("# relay_1: on=%d, off=%d\n", c.on_1, c.off_1));
+	DEBUG_PRINT(("# relay_2: on=%d, off=%d\n", c.on_2, c.off_2));
 }
 
-static void do_ditdah_length(int fd)
+static void do_waveform(struct kt_session *s)
 {
-	printf("* dit/dah length\n");
+	char file[256], select[64];
 
-	if (get_ditdah_length(fd, DIT_BIT, &dit_on, &dit_off) < 0) {
-		printf("dit too long\n");
+	if (kt_waveform_active(s)) {
+		printf("waveform export stopped, %d probes\n",
+		       kt_waveform_stop(s));
 		return;
 	}
 
-	if (get_ditdah_length(fd, DAH_BIT, &dah_on, &dah_off) < 0) {
-		printf("dah too long\n");
-		return;
-	}
-
-	printf("dit: on=%d, off=%d, on/off=%.3f\n",
-	       dit_on, dit_off, (double)dit_on / dit_off);
-	printf("dah: on=%d, off=%d, on/off=%.3f\n",
-	       dah_on, dah_off, (double)dah_on / dah_off);
-	printf("dah/dit: %.3f\n", (double)dah_on / dit_on);
-
-	dit_total = dit_on + dit_off;
-	dah_total = dah_on + dah_off;
-
-	printf("dit: total=%d, total/on=%.3f, total/off=%.3f\n",  dit_total,
-	       (double)dit_total / dit_on, (double)dit_total / dit_off);
-	printf("dah: total=%d, total/on=%.3f, total/off=%.3f\n", dah_total,
-	       (double)dah_total / dah_on, (double)dah_total / dah_off);
-	printf("dah total/dit total=%.3f\n", (double)dah_total / dit_total);
-}
-
-static int get_calibration_value(int fd, unsigned char mask, bool state)
-{
-	int n;
-	struct event *ev;
-	
-	set_maxpos(fd, CALIB_LEN);
+	printf("file name -> ");
+	if (fgets(file, sizeof(file), stdin) == NULL) return;
+	file[strcspn(file, "\r\n")] = '\0';
+	if (!*file) return;
 
-	ev = add_event_entry(eventbuf, 0, state ? 0 : mask, EVT_SET);
-	ev = add_event_entry(ev, CALIB_POS, state ? mask : 0, EVT_SET);
-	send_event_and_get_log(fd, 2);
+	printf("probes (all, or e.g. 1-4,7) -> ");
+	if (fgets(select, sizeof(select), stdin) == NULL) return;
+	select[strcspn(select, "\r\n")] = '\0';
 
-	ev = &unpacked_log[CALIB_POS];
-	n = CALIB_LEN - CALIB_POS;
-	if ((ev = find_event_entry(ev, &n, mask, state ? mask : 0)) != NULL)
-		return ev->pos - CALIB_POS;
+	if (kt_waveform_start(s, file, select) < 0) {
+		printf("cannot write %s\n", file);
+		return;
+	}
 
-	return -1;
+	printf("waveform export to %s (probes: %s)\n",
+	       file, *select ? select : "all");
 }
 
-static int load_config(void)
+static void do_stress(struct kt_session *s)
 {
-	FILE *fp;
+	char buf[64];
+	unsigned int seed;
+	int count;
 
-	if ((fp = fopen(CONFIG_FILE, "r")) == NULL) {
-		printf(CONFIG_FILE " not found\n");
-		return -1;
-	}
+	printf("seed (empty for random) -> ");
+	if (fgets(buf, sizeof(buf), stdin) == NULL) return;
+	seed = (*buf == '\n') ? (unsigned int)time(NULL) : strtoul(buf, NULL, 0);
 
-	fscanf(fp, "%d %d %d %d",
-	       &calib_on_1, &calib_off_1, &calib_on_2, &calib_off_2);
-	fclose(fp);
+	printf("programs -> ");
+	if (fgets(buf, sizeof(buf), stdin) == NULL) return;
+	if ((count = atoi(buf)) <= 0) count = 100;
 
-	return 0;
+	kt_stress(s, seed, count, STRESS_LOG);
 }
 
-static int save_config(void)
+static bool enter_pressed(void *arg)
 {
-	FILE *fp;
-
-	if ((fp = fopen(CONFIG_FILE, "w")) == NULL) {
-		printf("cannot write " CONFIG_FILE "\n");
-		return -1;
-	}
+	struct pollfd pfd;
+	char buf[256];
 
-	fprintf(fp, "%d %d %d %d\n",
-		calib_on_1, calib_off_1, calib_on_2, calib_off_2);
-	fclose(fp);
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return false;
 
-	return 0;
+	fgets(buf, sizeof(buf), stdin);
+	return true;
 }
 
-static void disp_config(void)
+static void do_monitor(struct kt_session *s)
 {
-	DEBUG_PRINT(("# relay_1: on=%d, off=%d\n", calib_on_1, calib_off_1));
-	DEBUG_PRINT(("# relay_2: on=%d, off=%d\n", calib_on_2, calib_off_2));
+	printf("press enter to stop\n");
+	kt_monitor(s, enter_pressed, NULL);
 }
 
-static void do_calibration(int fd)
-{
-#define CALIBRATION_TRY 4
-
-	int i;
-
-	calib_on_1 = calib_off_1 = calib_on_2 = calib_off_2 = 0;
-
-	for (i = 0; i < CALIBRATION_TRY; i++) {
-		calib_on_1 += get_calibration_value(fd, DIT_BIT, true);
-		calib_off_1 += get_calibration_value(fd, DIT_BIT, false);
-		calib_on_2 += get_calibration_value(fd, DAH_BIT, true);
-		calib_off_2 += get_calibration_value(fd, DAH_BIT, false);
-	}
-
-	calib_on_1 /= CALIBRATION_TRY;
-	calib_off_1 /= CALIBRATION_TRY;
-	calib_on_2 /= CALIBRATION_TRY;
-	calib_off_2 /= CALIBRATION_TRY;
-}
-
-static int do_main(int fd)
+static int do_main(struct kt_session *s, char *id)
 {
 	char buf[256];
 
-	load_config();
-	disp_config();
+	check_profile(s, id);
+	disp_config(s);
 
 menu:
 	printf("\n");
@@ -524,8 +284,12 @@ menu:
 	printf("2) check dit/dah memory (non-squeeze)\n");
 	printf("3) check dit/dah memory (squeeze)\n");
 	printf("4) check squeeze\n");
+	printf("s) stress (random programs)\n");
+	printf("m) live monitor\n");
+	printf("b) serial link benchmark\n");
 	printf("c) calibration\n");
-	printf("v) verbose output %s\n", verbose ? "off" : "on");
+	printf("v) verbose output %s\n", kt_get_verbose(s) ? "off" : "on");
+	printf("w) waveform export %s\n", kt_waveform_active(s) ? "off" : "on");
 	printf("x) exit\n");
 
 	printf("-> ");
@@ -537,36 +301,51 @@ menu:
 		return 0;
 	case 'v':
 	case 'V':
-		verbose = !verbose;
+		kt_set_verbose(s, !kt_get_verbose(s));
+		break;
+	case 'm':
+	case 'M':
+		do_monitor(s);
+		break;
+	case 'b':
+	case 'B':
+		kt_benchmark(s);
+		break;
+	case 's':
+	case 'S':
+		do_stress(s);
+		break;
+	case 'w':
+	case 'W':
+		do_waveform(s);
 		break;
 	case 'c':
 	case 'C':
-		do_calibration(fd);
-		disp_config();
-		save_config();
-		printf(CONFIG_FILE " saved\n");
+		if (kt_calibrate(s) < 0) {
+			printf("calibration failed, nothing saved\n");
+			break;
+		}
+		disp_config(s);
+		save_config(s);
+		save_profile(s, id);
+		printf(CONFIG_FILE " and " PROFILE_FILE " saved\n");
 		break;
 	case 'a':
 	case 'A':
 	case '0':
-		do_ditdah_length(fd);
-		if (*buf == '0') break;
+		if (kt_ditdah_length(s) < 0 || *buf == '0') break;
 		sleep(2);
 	case '1':
-		do_simple(fd);
-		if (*buf == '1') break;
+		if (kt_simple(s) < 0 || *buf == '1') break;
 		sleep(2);
 	case '2':
-		do_ditdah_memory2(fd);
-		if (*buf == '2') break;
+		if (kt_ditdah_memory2(s) < 0 || *buf == '2') break;
 		sleep(2);
 	case '3':
-		do_ditdah_memory(fd);
-		if (*buf == '3') break;
+		if (kt_ditdah_memory(s) < 0 || *buf == '3') break;
 		sleep(2);
 	case '4':
-		do_squeeze(fd);
-		if (*buf == '4') break;
+		if (kt_squeeze(s) < 0 || *buf == '4') break;
 		sleep(2);
 	default:
 		break;
@@ -577,31 +356,38 @@ menu:
 
 int	main(int argc, char *argv[])
 {
-	int	fd;
+	struct kt_session *s;
+	struct kt_callbacks cb = {print_message, print_result, NULL};
+	char id[256];
 
 	if (argc < 2) {
 		printf("%s [device]\n", argv[0]);
 		goto fin0;
 	}
 
-	fd = open_serial(argv[1]);
-	if (fd < 0) {
-		printf("device open error\n");
+	if ((s = kt_new(&cb)) == NULL) {
+		printf("out of memory\n");
 		goto fin0;
 	}
 
 	printf("wait for device...\n");
 
-	if (wait_for_device(fd)) {
+	switch (kt_open(s, argv[1])) {
+	case KT_ERR_OPEN:
+		printf("device open error\n");
+		goto fin1;
+	case KT_ERR_NOT_READY:
 		printf("device not ready\n");
 		goto fin1;
 	}
 
 	printf("device ready\n");
-	do_main(fd);
+	if (kt_device_id(argv[1], id, sizeof(id)) < 0)
+		snprintf(id, sizeof(id), "%s", argv[1]);
+	do_main(s, id);
 
 fin1:
-	close(fd);
+	kt_free(s);
 fin0:
 	return 0;
 }
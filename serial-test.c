@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+/*
+ * framing tests, against a fake device on the other end of a socketpair.
+ * serial.c is included to reach its static helpers.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "serial.c"
+
+#define LOG_ENTRY 70	/* three CMD_RESULT chunks */
+#define MON_FRAMES (FRAME_RETRY * 2)
+
+static int failed;
+
+#define CHECK(x)							\
+	do {								\
+		if (!(x)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #x);	\
+			failed++;					\
+		}							\
+	} while (0)
+
+static void make_log(struct event *ev, int n, int capture)
+{
+	int i;
+
+	/* pos values that need escaping on the wire */
+	for (i = 0; i < n; i++) {
+		ev[i].pos = FRAME_FLAG | (FRAME_ESC << 8);
+		ev[i].val = i + capture;
+		ev[i].evt = EVT_SET;
+	}
+}
+
+/* a frame with a broken crc, as line noise would leave it */
+static void send_damaged(struct link *l, unsigned char seq)
+{
+	unsigned char buf[] = {FRAME_FLAG, 0, 0x12, 0x34, 0x56, FRAME_FLAG};
+
+	buf[1] = seq;
+	write_serial(l, buf, sizeof(buf));
+}
+
+static void send_chunk(struct link *d, unsigned char seq, struct event *log, int k)
+{
+	unsigned char buf[2 + FRAME_LOG_ENTRY * sizeof(struct event)];
+	int n;
+
+	n = LOG_ENTRY - k * FRAME_LOG_ENTRY;
+	if (n > FRAME_LOG_ENTRY) n = FRAME_LOG_ENTRY;
+
+	buf[0] = LOG_ENTRY - 1;
+	buf[1] = k;
+	memcpy(&buf[2], &log[k * FRAME_LOG_ENTRY], n * sizeof(struct event));
+	send_frame(d, seq, buf, 2 + n * sizeof(struct event));
+}
+
+/*
+ * framed device: damages chunk 1 of the first CMD_RESULT, loses the
+ * second CMD_RESULT and the first CMD_SWEEP request, and re-sends its
+ * last response on a repeated seq.  every CMD_RESULT returns a new log,
+ * CMD_MONITOR queues MON_FRAMES frames of 3 events at once.
+ */
+static void fake_device(int fd)
+{
+	unsigned char req[FRAME_MAX], resp[2 + 255 * 2], seq, last = 0;
+	struct event log[LOG_ENTRY];
+	struct link d;
+	struct event ev[3];
+	int i, n, k, resp_len = 0, results = 0, sweeps = 0;
+	bool damage = true, monitor = false;
+
+	init_link(&d, fd);
+
+	while ((n = recv_frame(&d, &seq, req, sizeof(req), 2000)) != -1) {
+		if (n < 1)
+			continue;
+		if ((req[0] == CMD_SWEEP && !sweeps++) ||
+		    (req[0] == CMD_RESULT && results++ == 1))
+			continue; // lost on the way
+
+		if (seq == last && req[0] != CMD_RESULT) {
+			send_frame(&d, seq, resp, resp_len);
+			continue;
+		}
+		if (seq != last && req[0] == CMD_RESULT)
+			make_log(log, LOG_ENTRY, results);
+		last = seq;
+
+		switch (req[0]) {
+		case CMD_RESULT:
+			for (k = 0; k * FRAME_LOG_ENTRY < LOG_ENTRY; k++) {
+				if (k == 1 && damage)
+					send_damaged(&d, seq);
+				else
+					send_chunk(&d, seq, log, k);
+			}
+			damage = false;
+			resp_len = 0;
+			break;
+		case CMD_RESEND:
+			send_chunk(&d, seq, log, req[1]);
+			break;
+		case CMD_SWEEP:
+			for (k = 0; k <= req[4]; k++) {
+				resp[0] = k;
+				resp[1] = req[5];
+				for (i = 0; i < req[5]; i++) {
+					resp[2 + i * 2] = k + i;
+					resp[3 + i * 2] = 0;
+				}
+				resp_len = 2 + req[5] * 2;
+				send_frame(&d, seq, resp, resp_len);
+			}
+			break;
+		case CMD_MONITOR:
+			for (k = 0; k < MON_FRAMES; k++) {
+				for (i = 0; i < 3; i++) {
+					ev[i].pos = k * 3 + i;
+					ev[i].val = MON_OUT;
+					ev[i].evt = EVT_MON;
+				}
+				send_frame(&d, seq, (unsigned char *)ev,
+					   sizeof(ev));
+			}
+			monitor = true;
+			break;
+		default:
+			if (monitor) {
+				ev[0].evt = EVT_MONEND;
+				send_frame(&d, seq, (unsigned char *)ev,
+					   sizeof(ev[0]));
+				monitor = false;
+			}
+			resp[0] = RESP_ACK;
+			resp_len = 1;
+			send_frame(&d, seq, resp, resp_len);
+			break;
+		}
+	}
+
+	exit(0);
+}
+
+static void test_crc(void)
+{
+	unsigned char check[] = "123456789";
+
+	/* CRC-16/CCITT-FALSE check value */
+	CHECK(crc16(0xffff, check, 9) == 0x29b1);
+	CHECK(crc16(crc16(0xffff, check, 4), &check[4], 5) == 0x29b1);
+}
+
+static void test_escape(void)
+{
+	unsigned char buf[2];
+
+	CHECK(put_escaped(buf, 0x41) == 1 && buf[0] == 0x41);
+	CHECK(put_escaped(buf, FRAME_FLAG) == 2 &&
+	      buf[0] == FRAME_ESC && buf[1] == (FRAME_FLAG ^ 0x20));
+	CHECK(put_escaped(buf, FRAME_ESC) == 2 &&
+	      buf[0] == FRAME_ESC && buf[1] == (FRAME_ESC ^ 0x20));
+}
+
+static void test_frame(int fd0, int fd1)
+{
+	unsigned char out[256], in[FRAME_MAX], garbage[] = {0x00, 0x55, 0xaa};
+	unsigned char seq;
+	struct link a, b;
+	int i;
+
+	init_link(&a, fd0);
+	init_link(&b, fd1);
+	for (i = 0; i < sizeof(out); i++)
+		out[i] = i;
+
+	/* every byte value survives escaping */
+	send_frame(&a, FRAME_FLAG, out, sizeof(out));
+	CHECK(recv_frame(&b, &seq, in, sizeof(in), 100) == sizeof(out));
+	CHECK(seq == FRAME_FLAG && !memcmp(in, out, sizeof(out)));
+
+	/* leftovers and a damaged frame, then resync on the next flag */
+	write_serial(&a, garbage, sizeof(garbage));
+	send_damaged(&a, 1);
+	send_frame(&a, 2, out, 16);
+	CHECK(recv_frame(&b, &seq, in, sizeof(in), 100) == -2);
+	CHECK(recv_frame(&b, &seq, in, sizeof(in), 100) == 16);
+	CHECK(seq == 2 && !memcmp(in, out, 16));
+
+	/* too large for the buffer */
+	send_frame(&a, 3, out, 16);
+	CHECK(recv_frame(&b, &seq, in, 8, 100) == -2);
+
+	CHECK(recv_frame(&b, &seq, in, sizeof(in), 10) == -1);
+}
+
+static void test_device(int fd)
+{
+	struct event log[LOG_ENTRY], expect[LOG_ENTRY], ev;
+	struct link l;
+	int i, u[4 * 3];
+
+	init_link(&l, fd);
+	l.framed = true;
+	l.caps = CAP_FRAMED | CAP_SWEEP;
+
+	CHECK(ping_device(&l) == 0);
+
+	/* chunk 1 is damaged and fetched again with CMD_RESEND */
+	make_log(expect, LOG_ENTRY, 1);
+	memset(log, 0, sizeof(log));
+	CHECK(read_log(&l, log, LOG_ENTRY) == LOG_ENTRY);
+	CHECK(!memcmp(log, expect, sizeof(log)));
+	CHECK(l.resent == 1);
+
+	/* the request is lost, CMD_RESULT again rather than old chunks */
+	l.resent = 0;
+	make_log(expect, LOG_ENTRY, 3);
+	memset(log, 0, sizeof(log));
+	CHECK(read_log(&l, log, 40) == 40);
+	CHECK(!memcmp(log, expect, 40 * sizeof(struct event)));
+	CHECK(l.resent == 1);
+
+	/* the request is lost once and sent again after one capture */
+	l.resent = 0;
+	CHECK(set_maxpos(&l, 0x1000) == 0);
+	CHECK(run_sweep(&l, 4, 16, 4, u, 3) == 0);
+	for (i = 0; i < 4 * 3; i++)
+		CHECK(u[i] == i / 3 + i % 3);
+	CHECK(l.resent == 1);
+
+	/* more monitor frames in flight than retries, then EVT_MONEND */
+	l.resent = 0;
+	l.caps |= CAP_MONITOR;
+	CHECK(start_monitor(&l) >= 0);
+
+	/* one slot at a time, nothing of a 3-event frame is lost */
+	for (i = 0; i < 6; i++)
+		CHECK(read_monitor(&l, &ev, 1, 100) == 1 && ev.pos == i);
+
+	CHECK(stop_monitor(&l) == 0);
+	CHECK(l.resent == 0);
+	CHECK(ping_device(&l) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int sv[2], status;
+	pid_t pid;
+
+	test_crc();
+	test_escape();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	test_frame(sv[0], sv[1]);
+
+	if ((pid = fork()) == 0) {
+		close(sv[0]);
+		fake_device(sv[1]);
+	}
+	close(sv[1]);
+	test_device(sv[0]);
+	close(sv[0]);
+	waitpid(pid, &status, 0);
+
+	printf("%s\n", failed ? "FAIL" : "ok");
+
+	return failed ? 1 : 0;
+}
@@ -7,108 +7,690 @@
 #include <string.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
 #include "serial.h"
 
-static int read_serial(int fd, void *p, int len)
+#define FRAME_MAX (1 + 2 + MAX_ENTRY * sizeof(struct event) + 2)
+#define FRAME_RETRY 8
+#define BYTE_TIMEOUT 20		/* ms, within a frame */
+#define ACK_TIMEOUT 200		/* ms, command response */
+#define LOG_TIMEOUT 10000	/* ms, capture of an unknown window */
+
+#define BAUD_(b) B##b
+#define BAUD(b) BAUD_(b)	/* 38400 -> B38400 */
+
+static int read_serial(struct link *l, void *p, int len)
 {
 	int n, remain;
 
 	for (remain = len; remain > 0; remain -= n) {
-		if ((n = read(fd, p, remain)) < 0) return -1;
+		if ((n = read(l->fd, p, remain)) < 0) return -1;
+		l->rxbytes += n;
 		p += n;
 	}
 
 	return 0;
 }
 
-static int write_serial(int fd, void *p, int len)
+static int write_serial(struct link *l, void *p, int len)
 {
 	int n, remain;
 
 	for (remain = len; remain > 0; remain -= n) {
-		if ((n = write(fd, p, remain)) < 0) return -1;
+		if ((n = write(l->fd, p, remain)) < 0) return -1;
+		l->txbytes += n;
 		p += n;
 	}
 
 	return 0;
 }
 
-static int wait_for_ack(int fd)
+static int wait_for_ack(struct link *l)
 {
 	unsigned char c;
 
 	do {
-		read_serial(fd, &c, sizeof(c));
+		if (read_serial(l, &c, sizeof(c)) < 0)
+			return -1;
 	} while (c != RESP_ACK);
 
 	return 0;
 }
 
-int set_maxpos(int fd, int maxpos)
+/* unbuffered, for the exchanges before the mode is known */
+static int read_byte(struct link *l, unsigned char *c, int timeout)
+{
+	struct pollfd pfd;
+
+	pfd.fd = l->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) <= 0)
+		return -1;
+
+	return read_serial(l, c, sizeof(*c));
+}
+
+static int getc_timeout(struct link *l, int timeout)
+{
+	struct pollfd pfd;
+	int n;
+
+	if (l->rxpos >= l->rxlen) {
+		pfd.fd = l->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout) <= 0)
+			return -1;
+		if ((n = read(l->fd, l->rxbuf, sizeof(l->rxbuf))) <= 0)
+			return -1;
+		l->rxpos = 0;
+		l->rxlen = n;
+	}
+
+	l->rxbytes++;
+	return l->rxbuf[l->rxpos++];
+}
+
+static unsigned short crc16(unsigned short crc, unsigned char *p, int len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+static int put_escaped(unsigned char *out, unsigned char c)
+{
+	if (c == FRAME_FLAG || c == FRAME_ESC) {
+		out[0] = FRAME_ESC;
+		out[1] = c ^ 0x20;
+		return 2;
+	}
+
+	out[0] = c;
+	return 1;
+}
+
+static int send_frame(struct link *l, unsigned char seq, unsigned char *p, int len)
+{
+	unsigned char buf[FRAME_MAX * 2 + 2];
+	unsigned short crc;
+	int i, n;
+
+	crc = crc16(crc16(0xffff, &seq, 1), p, len);
+
+	n = 0;
+	buf[n++] = FRAME_FLAG;
+	n += put_escaped(&buf[n], seq);
+	for (i = 0; i < len; i++)
+		n += put_escaped(&buf[n], p[i]);
+	n += put_escaped(&buf[n], crc & 0xff);
+	n += put_escaped(&buf[n], crc >> 8);
+	buf[n++] = FRAME_FLAG;
+
+	return write_serial(l, buf, n);
+}
+
+/* returns payload length, -1 on timeout, -2 on a damaged frame */
+static int recv_frame(struct link *l, unsigned char *seq, unsigned char *p, int size, int timeout)
+{
+	unsigned char buf[FRAME_MAX];
+	int c, n;
+	bool esc;
+
+	/* resync: anything before a flag is a leftover of a broken frame */
+	do {
+		if ((c = getc_timeout(l, timeout)) < 0)
+			return -1;
+	} while (c != FRAME_FLAG);
+
+	for (n = 0, esc = false; ; ) {
+		if ((c = getc_timeout(l, BYTE_TIMEOUT)) < 0)
+			return -2;
+
+		if (c == FRAME_FLAG) {
+			if (!n) continue; // back-to-back flags
+			break;
+		}
+
+		if (c == FRAME_ESC) {
+			esc = true;
+			continue;
+		}
+
+		if (n >= sizeof(buf))
+			return -2;
+		buf[n++] = esc ? (c ^ 0x20) : c;
+		esc = false;
+	}
+
+	if (n < 3 || crc16(0xffff, buf, n - 2) !=
+	    (buf[n - 2] | (buf[n - 1] << 8)) || n - 3 > size)
+		return -2;
+
+	*seq = buf[0];
+	memcpy(p, &buf[1], n - 3);
+
+	return n - 3;
+}
+
+/* send one request, retransmit until the response with its seq arrives */
+static int transact(struct link *l, unsigned char *req, int reqlen, unsigned char *resp, int size, int timeout)
+{
+	unsigned char buf[FRAME_MAX], seq;
+	int i, n;
+
+	l->seq++;
+	for (i = 0; i < FRAME_RETRY; i++) {
+		if (i) l->resent++;
+		send_frame(l, l->seq, req, reqlen);
+
+		/* stale frames of earlier requests are dropped before sizing */
+		do {
+			n = recv_frame(l, &seq, buf, sizeof(buf), timeout);
+		} while (n >= 0 && seq != l->seq);
+
+		if (n >= 0 && n <= size) {
+			memcpy(resp, buf, n);
+			return n;
+		}
+	}
+
+	return -1;
+}
+
+/* one capture of the current window, then the response */
+static int capture_timeout(struct link *l)
+{
+	if (l->maxpos < 0)
+		return LOG_TIMEOUT;
+
+	return (long long)l->maxpos * TICK_NS / 1000000 + ACK_TIMEOUT;
+}
+
+static int transact_ack(struct link *l, unsigned char *req, int reqlen, int timeout)
 {
 	unsigned char c;
 
-	c = CMD_MAXPOS;
-	write_serial(fd, &c, sizeof(c));
+	if (transact(l, req, reqlen, &c, sizeof(c), timeout) != 1 ||
+	    c != RESP_ACK)
+		return -1;
+
+	return 0;
+}
+
+int ping_device(struct link *l)
+{
+	unsigned char c;
+
+	c = CMD_READY;
+
+	if (l->framed)
+		return transact_ack(l, &c, sizeof(c), ACK_TIMEOUT);
+
+	if (write_serial(l, &c, sizeof(c)) < 0)
+		return -1;
+
+	return wait_for_ack(l);
+}
 
-	c = (maxpos >> 8) - 1;
-	write_serial(fd, &c, sizeof(c));
+int set_maxpos(struct link *l, int maxpos)
+{
+	unsigned char c[2];
+
+	/* only a device that retains its state can skip this */
+	if ((l->caps & CAP_PATCH) && maxpos == l->maxpos)
+		return 0;
+
+	c[0] = CMD_MAXPOS;
+	c[1] = (maxpos >> 8) - 1;
+
+	if (l->framed) {
+		if (transact_ack(l, c, sizeof(c), ACK_TIMEOUT) < 0) {
+			l->maxpos = -1;
+			return -1;
+		}
+	} else if (write_serial(l, c, sizeof(c)) < 0 || wait_for_ack(l) < 0) {
+		l->maxpos = -1;
+		return -1;
+	}
 
-	wait_for_ack(fd);
+	l->maxpos = maxpos;
 
 	return 0;
 }
 
-int start_log(int fd)
+int start_log(struct link *l)
 {
 	unsigned char c;
 
 	c = CMD_LOG;
-	write_serial(fd, &c, sizeof(c));
 
-	wait_for_ack(fd);
+	if (l->framed)
+		return transact_ack(l, &c, sizeof(c), capture_timeout(l));
 
-	return 0;
+	if (write_serial(l, &c, sizeof(c)) < 0)
+		return -1;
+
+	return wait_for_ack(l);
+}
+
+/* chunks that hold the first size of entry log entries */
+static int log_chunks(int entry, int size)
+{
+	if (entry > size)
+		entry = size;
+
+	return (entry + FRAME_LOG_ENTRY - 1) / FRAME_LOG_ENTRY;
 }
 
-int read_log(int fd, struct event *out, int size)
+static int read_log_framed(struct link *l, struct event *out, int size)
+{
+	unsigned char buf[2 + FRAME_LOG_ENTRY * sizeof(struct event)];
+	unsigned char req[2], seq;
+	unsigned int got;
+	int i, n, k, entry, chunks, retry;
+
+	req[0] = CMD_RESULT;
+	l->seq++;
+	send_frame(l, l->seq, req, 1);
+
+	/* chunks stream back to back, note which ones arrived intact */
+	entry = chunks = -1;
+	got = 0;
+	for (i = retry = 0; i < MAX_ENTRY / FRAME_LOG_ENTRY + FRAME_RETRY; ) {
+		if (chunks >= 0 && got == (1U << chunks) - 1)
+			break;
+		if ((n = recv_frame(l, &seq, buf, sizeof(buf), (chunks >= 0) ?
+				    BYTE_TIMEOUT * 4 : ACK_TIMEOUT)) == -1) {
+			/*
+			 * nothing of this capture yet: the request or all of
+			 * the response was lost.  CMD_RESEND would answer
+			 * from the previous capture, so ask again instead.
+			 */
+			if (chunks >= 0 || retry++ >= FRAME_RETRY)
+				break;
+			l->resent++;
+			send_frame(l, l->seq, req, 1);
+			i = 0;
+			continue;
+		}
+		i++;
+		if (n < 2 || seq != l->seq)
+			continue;
+
+		entry = buf[0] + 1;
+		chunks = log_chunks(entry, size);
+		k = buf[1];
+		if (k >= chunks)
+			continue;
+
+		n = (n - 2) / sizeof(struct event);
+		if (k * FRAME_LOG_ENTRY + n > size)
+			n = size - k * FRAME_LOG_ENTRY;
+		memcpy(&out[k * FRAME_LOG_ENTRY], &buf[2],
+		       n * sizeof(struct event));
+		got |= 1U << k;
+	}
+
+	if (chunks < 0)
+		return -1;
+
+	/* selective retransmit of the damaged ones */
+	req[0] = CMD_RESEND;
+	for (k = 0; k < chunks; k++) {
+		if (got & (1U << k))
+			continue;
+
+		req[1] = k;
+		l->resent++;
+		if ((n = transact(l, req, sizeof(req), buf, sizeof(buf),
+				  ACK_TIMEOUT)) < 2 || buf[1] != k)
+			return -1;
+
+		entry = buf[0] + 1;
+		chunks = log_chunks(entry, size);
+
+		n = (n - 2) / sizeof(struct event);
+		if (k * FRAME_LOG_ENTRY + n > size)
+			n = size - k * FRAME_LOG_ENTRY;
+		if (n > 0)
+			memcpy(&out[k * FRAME_LOG_ENTRY], &buf[2],
+			       n * sizeof(struct event));
+		got |= 1U << k;
+	}
+
+	return (entry < size) ? entry : size;
+}
+
+int read_log(struct link *l, struct event *out, int size)
 {
 	unsigned char c, n;
-	int entry;
+	struct event discard;
+	int entry, i;
+
+	if (l->framed)
+		return read_log_framed(l, out, size);
 
 	c = CMD_RESULT;
-	write_serial(fd, &c, sizeof(c));
-	
-	if (read_serial(fd, &n, sizeof(n)) < 0)
-		entry = 0;
-	else
-		entry = n + 1;
+	if (write_serial(l, &c, sizeof(c)) < 0 ||
+	    read_serial(l, &n, sizeof(n)) < 0)
+		return -1;
+	entry = n + 1;
 
-	if (entry)
-		read_serial(fd, out, entry * sizeof(struct event));
-	
-	wait_for_ack(fd);
+	/* never write past out[size], but keep the stream in sync */
+	for (i = 0; i < entry; i++) {
+		if (read_serial(l, (i < size) ? &out[i] : &discard,
+				sizeof(struct event)) < 0)
+			return -1;
+	}
+
+	if (wait_for_ack(l) < 0)
+		return -1;
 
-	return entry;
+	return (entry < size) ? entry : size;
 }
 
-int write_event(int fd, struct event *ev, int entry)
+static void get_intervals(unsigned char *p, int n, int *out, int results)
 {
-	unsigned char c, n;
+	int i;
+
+	for (i = 0; i < results; i++)
+		out[i] = (i < n) ? (p[i * 2] | (p[i * 2 + 1] << 8)) : -1;
+}
+
+static int run_sweep_framed(struct link *l, unsigned char *req, int count, int *out, int results)
+{
+	unsigned char buf[2 + 255 * 2], resend[2], seq;
+	unsigned char got[256];
+	int i, n, k;
+
+	memset(got, 0, sizeof(got));
+
+	l->seq++;
+	send_frame(l, l->seq, req, 6);
+
+	/* one frame per run, each arrives after its capture */
+	for (i = k = 0; k < count; ) {
+		if ((n = recv_frame(l, &seq, buf, sizeof(buf),
+				    capture_timeout(l))) == -1) {
+			/* nothing at all: the request itself was lost */
+			if (k || i++ >= FRAME_RETRY)
+				break;
+			l->resent++;
+			send_frame(l, l->seq, req, 6);
+			continue;
+		}
+		if (n < 2 || seq != l->seq || buf[0] >= count ||
+		    n < 2 + buf[1] * 2 || got[buf[0]])
+			continue;
+
+		get_intervals(&buf[2], buf[1], &out[buf[0] * results], results);
+		got[buf[0]] = 1;
+		k++;
+	}
+
+	/* CMD_RESEND would answer from the previous sweep */
+	if (!k)
+		return -1;
 
-	c = CMD_EVENT;
-	write_serial(fd, &c, sizeof(c));
+	resend[0] = CMD_RESEND;
+	for (k = 0; k < count; k++) {
+		if (got[k])
+			continue;
 
-	n = entry - 1;
-	write_serial(fd, &n, sizeof(n));
-	write_serial(fd, ev, sizeof(struct event) * entry);
+		resend[1] = k;
+		l->resent++;
+		if ((n = transact(l, resend, sizeof(resend), buf, sizeof(buf),
+				  ACK_TIMEOUT)) < 2 || buf[0] != k ||
+		    n < 2 + buf[1] * 2)
+			return -1;
 
-	wait_for_ack(fd);
+		get_intervals(&buf[2], buf[1], &out[k * results], results);
+	}
 
 	return 0;
 }
 
+int run_sweep(struct link *l, int first, int step, int count, int *out, int results)
+{
+	unsigned char req[6], buf[255 * 2], n;
+	int k;
+
+	if (!(l->caps & CAP_SWEEP) || count < 1 || count > 256 ||
+	    results < 1 || results > 255 || step < 0 || step > 0xffff)
+		return -1;
+
+	req[0] = CMD_SWEEP;
+	req[1] = first;
+	req[2] = step & 0xff;
+	req[3] = step >> 8;
+	req[4] = count - 1;
+	req[5] = results;
+
+	if (l->framed)
+		return run_sweep_framed(l, req, count, out, results);
+
+	if (write_serial(l, req, sizeof(req)) < 0)
+		return -1;
+
+	for (k = 0; k < count; k++) {
+		if (read_serial(l, &n, sizeof(n)) < 0 ||
+		    read_serial(l, buf, n * 2) < 0)
+			return -1;
+		get_intervals(buf, n, &out[k * results], results);
+	}
+
+	return wait_for_ack(l);
+}
+
+static int send_program(struct link *l, unsigned char *buf, int len)
+{
+	if (l->framed)
+		return transact_ack(l, buf, len, ACK_TIMEOUT);
+
+	if (write_serial(l, buf, len) < 0)
+		return -1;
+
+	return wait_for_ack(l);
+}
+
+int write_event(struct link *l, struct event *ev, int entry)
+{
+	unsigned char buf[4 + MAX_ENTRY * sizeof(struct event)];
+	int first, last, len;
+
+	/* changed range against what the device already holds */
+	first = 0;
+	last = entry - 1;
+	if (l->prog_entry >= 0 && (l->caps & CAP_PATCH)) {
+		for (; first < entry && first < l->prog_entry; first++) {
+			if (memcmp(&ev[first], &l->prog[first],
+				   sizeof(struct event)))
+				break;
+		}
+		for (; last >= first && last < l->prog_entry; last--) {
+			if (memcmp(&ev[last], &l->prog[last],
+				   sizeof(struct event)))
+				break;
+		}
+		if (first > last && entry == l->prog_entry)
+			return 0;
+	}
+
+	if (first > last) // shortened, rewrite the last entry
+		first = last = entry - 1;
+
+	if (l->prog_entry >= 0 && (l->caps & CAP_PATCH) &&
+	    last - first + 1 < entry) {
+		buf[0] = CMD_PATCH;
+		buf[1] = first;
+		buf[2] = last - first;
+		buf[3] = entry - 1;
+		memcpy(&buf[4], &ev[first],
+		       sizeof(struct event) * (last - first + 1));
+		len = 4 + sizeof(struct event) * (last - first + 1);
+	} else {
+		buf[0] = CMD_EVENT;
+		buf[1] = entry - 1;
+		memcpy(&buf[2], ev, sizeof(struct event) * entry);
+		len = 2 + sizeof(struct event) * entry;
+	}
+
+	if (send_program(l, buf, len) < 0) {
+		l->prog_entry = -1;
+		return -1;
+	}
+
+	memcpy(l->prog, ev, sizeof(struct event) * entry);
+	l->prog_entry = entry;
+
+	return 0;
+}
+
+int start_monitor(struct link *l)
+{
+	unsigned char c;
+
+	if (!(l->caps & CAP_MONITOR))
+		return -1;
+
+	c = CMD_MONITOR;
+	l->monpos = l->monlen = 0;
+
+	if (l->framed) {
+		l->seq++;
+		return send_frame(l, l->seq, &c, sizeof(c));
+	}
+
+	return write_serial(l, &c, sizeof(c));
+}
+
+/* returns number of events, 0 on timeout, -1 on EVT_MONEND or error */
+int read_monitor(struct link *l, struct event *out, int size, int timeout)
+{
+	unsigned char seq, *p;
+	int c, i, n;
+
+	if (l->framed) {
+		/* a frame may hold more than fits, the rest waits here */
+		if (l->monpos >= l->monlen) {
+			do {
+				if ((n = recv_frame(l, &seq,
+						    (unsigned char *)l->mon,
+						    sizeof(l->mon),
+						    timeout)) == -1)
+					return 0;
+			} while (n < 0 || seq != l->seq); // damaged is lost
+
+			l->monpos = 0;
+			l->monlen = n / sizeof(struct event);
+		}
+
+		n = l->monlen - l->monpos;
+		if (n > size) n = size;
+		memcpy(out, &l->mon[l->monpos], n * sizeof(struct event));
+		l->monpos += n;
+	} else {
+		/* first event waits, the rest only takes what has arrived */
+		for (n = 0; n < size; n++) {
+			if (n && l->rxpos + sizeof(struct event) > l->rxlen)
+				break;
+			p = (unsigned char *)&out[n];
+			for (i = 0; i < sizeof(struct event); i++) {
+				if ((c = getc_timeout(l, (n || i) ?
+						      BYTE_TIMEOUT :
+						      timeout)) < 0)
+					return (n || i) ? -1 : 0;
+				p[i] = c;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (out[i].evt == EVT_MONEND)
+			return -1;
+	}
+
+	return n;
+}
+
+/*
+ * monitor frames still in flight come first, then EVT_MONEND and the
+ * ACK of the stop request.  the request is sent again when the stream
+ * goes quiet without EVT_MONEND, the device answers that from its
+ * previous response.
+ */
+static int stop_monitor_framed(struct link *l, unsigned char c)
+{
+	unsigned char buf[FRAME_MAX], seq;
+	struct event *ev;
+	int i, n, retry;
+	bool end;
+
+	l->seq++;
+	send_frame(l, l->seq, &c, sizeof(c));
+
+	end = false;
+	for (i = retry = 0; i < 0x10000; i++) {
+		if ((n = recv_frame(l, &seq, buf, sizeof(buf),
+				    ACK_TIMEOUT)) == -1) {
+			if (retry++ >= FRAME_RETRY)
+				break;
+			l->resent++;
+			send_frame(l, l->seq, &c, sizeof(c));
+			continue;
+		}
+		if (n < 0)
+			continue;
+
+		if (end && seq == l->seq && n == 1)
+			return (buf[0] == RESP_ACK) ? 0 : -1;
+
+		for (ev = (struct event *)buf;
+		     (unsigned char *)(ev + 1) <= buf + n; ev++) {
+			if (ev->evt == EVT_MONEND)
+				end = true;
+		}
+	}
+
+	return -1;
+}
+
+int stop_monitor(struct link *l)
+{
+	struct event ev;
+	unsigned char c;
+	int i, n;
+
+	c = CMD_READY;
+
+	if (l->framed)
+		return stop_monitor_framed(l, c);
+
+	write_serial(l, &c, sizeof(c));
+
+	/* drain the stream up to EVT_MONEND, then its ACK */
+	for (i = 0; i < 0x10000; i++) {
+		if ((n = read_monitor(l, &ev, 1, ACK_TIMEOUT)) < 0)
+			break;
+		if (!n)
+			return -1;
+	}
+
+	while ((n = getc_timeout(l, ACK_TIMEOUT)) >= 0 && n != RESP_ACK)
+		;
+
+	return (n == RESP_ACK) ? 0 : -1;
+}
+
 static bool set_nonblock(int d, bool nonblock)
 {
 	int flags;
@@ -128,8 +710,8 @@ int open_serial(char *serdev)
 		goto fin0;
 
 	memset(&t, 0, sizeof(t));
-	cfsetospeed(&t, B38400);
-	cfsetispeed(&t, B38400);
+	cfsetospeed(&t, BAUD(SERIAL_BAUD));
+	cfsetispeed(&t, BAUD(SERIAL_BAUD));
 
 	t.c_cflag |= CREAD | CLOCAL | CS8;
 	t.c_iflag = INPCK;
@@ -158,18 +740,121 @@ int wait_for_device(int fd)
 
 		if (read(fd, &c, sizeof(c)) >= 1) {
 			if (c == RESP_ACK) break;
-			else return -1;
+			else return SERIAL_ERR_NOT_READY;
 		}
 		    
 		sleep(1);
 	}
 	if (i >= 10)
+		return SERIAL_ERR_NOT_READY;
+
+	if (set_nonblock(fd, false))
+		return SERIAL_ERR_NONBLOCK;
+
+	return 0;
+}
+
+static int read_sysfs(char *dir, char *name, char *buf, int size)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((fp = fopen(path, "r")) == NULL)
 		return -1;
 
-	if (set_nonblock(fd, false)) {
-		printf("non-block mode set failed\n");
+	if (fgets(buf, size, fp) == NULL)
+		*buf = '\0';
+	buf[strcspn(buf, "\r\n")] = '\0';
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * stable identity of the adapter behind serdev: USB vendor:product and
+ * serial number, or the USB port path when there is no serial number.
+ * falls back to the resolved device name for non-USB ports.
+ */
+int get_serial_id(char *serdev, char *buf, int size)
+{
+	char dev[PATH_MAX], path[PATH_MAX], dir[PATH_MAX], *p;
+	char vid[16], pid[16], serial[128];
+
+	if (realpath(serdev, dev) == NULL)
 		return -1;
+
+	snprintf(path, sizeof(path), "/sys/class/tty/%s/device",
+		 basename(dev));
+	if (realpath(path, dir) != NULL) {
+		/* walk up to the USB device node */
+		while (strcmp(dir, "/") && strcmp(dir, ".")) {
+			if (!read_sysfs(dir, "idVendor", vid, sizeof(vid)) &&
+			    !read_sysfs(dir, "idProduct", pid, sizeof(pid))) {
+				if (read_sysfs(dir, "serial",
+					       serial, sizeof(serial)) ||
+				    !*serial)
+					snprintf(serial, sizeof(serial),
+						 "port-%s", basename(dir));
+				snprintf(buf, size, "usb-%s:%s-%s",
+					 vid, pid, serial);
+				for (p = buf; *p; p++)
+					if (*p <= ' ') *p = '_';
+				return 0;
+			}
+			p = dirname(dir);
+			memmove(dir, p, strlen(p) + 1);
+		}
 	}
 
+	snprintf(buf, size, "%s", dev);
+
 	return 0;
 }
+
+void init_link(struct link *l, int fd)
+{
+	memset(l, 0, sizeof(*l));
+	l->fd = fd;
+	invalidate_link(l);
+}
+
+void invalidate_link(struct link *l)
+{
+	l->prog_entry = -1;
+	l->maxpos = -1;
+}
+
+int negotiate_link(struct link *l)
+{
+	unsigned char c, caps;
+
+	/*
+	 * caps come after RESP_ACK, so they never read as ACK/NAK.
+	 * firmware without CMD_CAPS answers RESP_NAK, or nothing at all.
+	 */
+	c = CMD_CAPS;
+	write_serial(l, &c, sizeof(c));
+
+	if (read_byte(l, &c, ACK_TIMEOUT) < 0 || c != RESP_ACK ||
+	    read_byte(l, &caps, ACK_TIMEOUT) < 0) {
+		tcflush(l->fd, TCIFLUSH);
+		l->caps = 0;
+		return 0;
+	}
+
+	l->caps = caps;
+
+	if (l->caps & CAP_FRAMED) {
+		c = CMD_FRAMED;
+		write_serial(l, &c, sizeof(c));
+		if (read_byte(l, &c, ACK_TIMEOUT) < 0 || c != RESP_ACK) {
+			tcflush(l->fd, TCIFLUSH);
+			l->caps &= ~CAP_FRAMED;
+		} else {
+			l->framed = true;
+		}
+	}
+
+	return l->caps;
+}
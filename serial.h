@@ -4,14 +4,44 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include <stdbool.h>
 #include "keyer-test-arduino.h"
 #include "serial.h"
 
-int set_maxpos(int, int);
-int start_log(int);
-int read_log(int, struct event *, int);
-int write_event(int, struct event *, int);
+#define SERIAL_ERR_NOT_READY (-1)	/* wait_for_device() */
+#define SERIAL_ERR_NONBLOCK (-2)
+
+#define SERIAL_BAUD 38400	/* termios B<n> is derived from this */
+
+struct link {
+	int fd;
+	int caps;
+	bool framed;
+	unsigned char seq;
+	int resent;
+	unsigned long txbytes, rxbytes;	/* on the line, incl. framing */
+	struct event prog[MAX_ENTRY];	/* program held by the device */
+	int prog_entry, maxpos;		/* -1: unknown */
+	unsigned char rxbuf[256];
+	int rxpos, rxlen;
+	struct event mon[MAX_ENTRY];	/* rest of a framed monitor frame */
+	int monpos, monlen;
+};
+
+int ping_device(struct link *);
+int set_maxpos(struct link *, int);
+int start_log(struct link *);
+int read_log(struct link *, struct event *, int);
+int write_event(struct link *, struct event *, int);
+int run_sweep(struct link *, int, int, int, int *, int);
+int start_monitor(struct link *);
+int read_monitor(struct link *, struct event *, int, int);
+int stop_monitor(struct link *);
 int open_serial(char *);
 int wait_for_device(int);
+int get_serial_id(char *, char *, int);
+void init_link(struct link *, int);
+void invalidate_link(struct link *);
+int negotiate_link(struct link *);
 
 #endif
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "vcd.h"
+#include "event.h"
+
+/* VCD only allows 1/10/100 units, so log ticks are scaled to 1us */
+#define VCD_TIMESCALE "1us"
+#define VCD_TICK (TICK_NS / 1000)
+
+#define ID_DIT '!'
+#define ID_DAH '"'
+#define ID_OUT '#'
+#define ID_LOG '$'
+#define ID_PROBE '%'
+
+struct change {
+	unsigned int pos;
+	unsigned char val;
+	unsigned char log;
+};
+
+static void put_vector(FILE *fp, unsigned int v, int width, char id)
+{
+	int i;
+
+	fputc('b', fp);
+	for (i = width - 1; i >= 0; i--)
+		fputc((v & (1U << i)) ? '1' : '0', fp);
+	fprintf(fp, " %c\n", id);
+}
+
+static int log_level(struct event *log, int entry, unsigned int pos)
+{
+	int val = 0;
+
+	for (; entry > 0 && log->pos <= pos; entry--, log++)
+		val = log->val;
+
+	return val;
+}
+
+static int add_change(struct change *c, int n, unsigned int pos, int val, int log)
+{
+	int i;
+
+	/* insertion sort, stable for the same position */
+	for (i = n; i > 0 && c[i - 1].pos > pos; i--)
+		c[i] = c[i - 1];
+
+	c[i].pos = pos;
+	c[i].val = val;
+	c[i].log = log;
+
+	return n + 1;
+}
+
+int vcd_open(struct vcd *v, char *filename, char *select)
+{
+	time_t t;
+	char date[32];	/* ctime_r() needs 26 */
+
+	memset(v, 0, sizeof(*v));
+	if ((v->fp = fopen(filename, "w")) == NULL)
+		return -1;
+
+	snprintf(v->select, sizeof(v->select), "%s",
+		 (select != NULL && *select) ? select : "all");
+
+	time(&t);
+	fprintf(v->fp, "$date %.24s $end\n", ctime_r(&t, date));
+	fprintf(v->fp, "$version keyer-test $end\n");
+	fprintf(v->fp, "$timescale " VCD_TIMESCALE " $end\n");
+	fprintf(v->fp, "$scope module keyer $end\n");
+	fprintf(v->fp, "$var wire 1 %c dit $end\n", ID_DIT);
+	fprintf(v->fp, "$var wire 1 %c dah $end\n", ID_DAH);
+	fprintf(v->fp, "$var wire 1 %c out $end\n", ID_OUT);
+	fprintf(v->fp, "$var wire 8 %c log $end\n", ID_LOG);
+	fprintf(v->fp, "$var integer 16 %c probe $end\n", ID_PROBE);
+	fprintf(v->fp, "$upscope $end\n");
+	fprintf(v->fp, "$enddefinitions $end\n");
+	fprintf(v->fp, "#0\n$dumpvars\n0%c\n0%c\n0%c\n",
+		ID_DIT, ID_DAH, ID_OUT);
+	put_vector(v->fp, 0, 8, ID_LOG);
+	put_vector(v->fp, 0, 16, ID_PROBE);
+	fprintf(v->fp, "$end\n");
+
+	return 0;
+}
+
+bool vcd_selected(struct vcd *v, int probe)
+{
+	char *p;
+	long from, to;
+
+	if (!strcmp(v->select, "all"))
+		return true;
+
+	/* "1-4,7,10-" style list, 1-origin */
+	for (p = v->select; *p; ) {
+		from = strtol(p, &p, 10);
+		to = from;
+		if (*p == '-') {
+			p++;
+			to = (*p >= '0' && *p <= '9') ?
+				strtol(p, &p, 10) : 0x7fffffffL;
+		}
+		if (probe >= from && probe <= to)
+			return true;
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	return false;
+}
+
+void vcd_add_probe(struct vcd *v, struct event *stim, int stim_entry, struct event *log, int log_entry, int len)
+{
+	struct change c[MAX_ENTRY * 2];
+	struct event *ev;
+	unsigned int base, t, level, last;
+	int i, j, n, stim_val, log_val;
+
+	v->probe++;
+	if (v->fp == NULL || !vcd_selected(v, v->probe))
+		return;
+
+	/* stimulus, resolve EVT_CHGSTS against the captured log */
+	for (i = n = 0, base = 0, t = 0; i < stim_entry; i++, stim++) {
+		if (stim->evt == EVT_CHGSTS) {
+			level = log_level(log, log_entry, t) & stim->val;
+			for (j = 0, ev = log; j < log_entry; j++, ev++) {
+				if (ev->pos > t &&
+				    (ev->val & stim->val) != level)
+					break;
+			}
+			if (j >= log_entry)
+				break;
+			base = ev->pos + stim->pos;
+			t = base;
+			continue;
+		}
+
+		t = base + stim->pos;
+		n = add_change(c, n, t, stim->val, 0);
+	}
+
+	for (i = 0; i < log_entry; i++)
+		n = add_change(c, n, log[i].pos, log[i].val, 1);
+
+	fprintf(v->fp, "$comment probe %d $end\n", v->probe);
+	fprintf(v->fp, "#%lu\n0%c\n0%c\n0%c\n", v->time * VCD_TICK,
+		ID_DIT, ID_DAH, ID_OUT);
+	put_vector(v->fp, 0, 8, ID_LOG);
+	put_vector(v->fp, v->probe, 16, ID_PROBE);
+
+	stim_val = log_val = 0;
+	last = 0;
+	for (i = 0; i < n && c[i].pos < len; i++) {
+		if (c[i].log) {
+			if (c[i].val == log_val)
+				continue;
+		} else {
+			if (c[i].val == stim_val)
+				continue;
+		}
+
+		if (c[i].pos != last) {
+			fprintf(v->fp, "#%lu\n",
+				(v->time + c[i].pos) * VCD_TICK);
+			last = c[i].pos;
+		}
+
+		if (c[i].log) {
+			if ((c[i].val ^ log_val) & OUT_BIT)
+				fprintf(v->fp, "%d%c\n",
+					!!(c[i].val & OUT_BIT), ID_OUT);
+			put_vector(v->fp, c[i].val, 8, ID_LOG);
+			log_val = c[i].val;
+		} else {
+			if ((c[i].val ^ stim_val) & DIT_BIT)
+				fprintf(v->fp, "%d%c\n",
+					!!(c[i].val & DIT_BIT), ID_DIT);
+			if ((c[i].val ^ stim_val) & DAH_BIT)
+				fprintf(v->fp, "%d%c\n",
+					!!(c[i].val & DAH_BIT), ID_DAH);
+			stim_val = c[i].val;
+		}
+	}
+
+	v->time += len;
+}
+
+void vcd_close(struct vcd *v)
+{
+	if (v->fp == NULL)
+		return;
+
+	fprintf(v->fp, "#%lu\n", v->time * VCD_TICK);
+	fclose(v->fp);
+	v->fp = NULL;
+}
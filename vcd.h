@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+// SPDX-FileCopyrightText: 2025 SASANO Takayoshi <uaa@uaa.org.uk>
+
+#ifndef VCD_H
+#define VCD_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "keyer-test-arduino.h"
+
+struct vcd {
+	FILE *fp;
+	char select[64];
+	unsigned long time;
+	int probe;
+};
+
+int vcd_open(struct vcd *, char *, char *);
+bool vcd_selected(struct vcd *, int);
+void vcd_add_probe(struct vcd *, struct event *, int, struct event *, int, int);
+void vcd_close(struct vcd *);
+
+#endif